@@ -0,0 +1,226 @@
+#include "bucket_storage.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <random>
+#include <vector>
+
+/* Microbenchmark suite for BucketStorage (make bench && ./bench)
+ * Every workload runs over element sizes of 4, 64 and 256 bytes,
+ * trivially copyable and non-trivial element types
+ * and block capacities from 1 to 4096.
+ * Reported: time per operation (time/op), operations per second (items_per_second)
+ * and heap bytes per stored element (bytes/element).
+ * The Time column is per benchmark iteration, which is a batch of operations
+ * for insert_only, erase_heavy and iterate_only.
+ */
+
+const size_t elements = 1 << 14;
+
+// heap bytes currently allocated through operator new
+size_t heap_bytes = 0;
+
+void *operator new(size_t size)
+{
+	if (void *ptr = std::malloc(size ? size : 1))
+	{
+		heap_bytes += malloc_usable_size(ptr);
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+void operator delete(void *ptr) noexcept
+{
+	heap_bytes -= malloc_usable_size(ptr);
+	std::free(ptr);
+}
+void operator delete(void *ptr, size_t) noexcept
+{
+	operator delete(ptr);
+}
+
+// Size bytes payload, trivially copyable or with user-provided copy, move and destructor
+template< size_t Size, bool Trivial >
+struct Payload
+{
+	explicit Payload(int i) : x(i) {}
+	Payload(const Payload &p) requires(!Trivial) : x(p.x) { benchmark::DoNotOptimize(this); }
+	Payload(const Payload &p) requires Trivial = default;
+	Payload(Payload &&p) noexcept requires(!Trivial) : x(p.x) { benchmark::DoNotOptimize(this); }
+	Payload(Payload &&p) noexcept requires Trivial = default;
+	Payload &operator=(const Payload &) = default;
+	Payload &operator=(Payload &&) = default;
+	~Payload() requires(!Trivial) { benchmark::DoNotOptimize(this); }
+	~Payload() requires Trivial = default;
+
+	int x;
+	char padding[Size - sizeof(int)];
+};
+
+template< bool Trivial >
+struct Payload< sizeof(int), Trivial >
+{
+	explicit Payload(int i) : x(i) {}
+	Payload(const Payload &p) requires(!Trivial) : x(p.x) { benchmark::DoNotOptimize(this); }
+	Payload(const Payload &p) requires Trivial = default;
+	Payload(Payload &&p) noexcept requires(!Trivial) : x(p.x) { benchmark::DoNotOptimize(this); }
+	Payload(Payload &&p) noexcept requires Trivial = default;
+	Payload &operator=(const Payload &) = default;
+	Payload &operator=(Payload &&) = default;
+	~Payload() requires(!Trivial) { benchmark::DoNotOptimize(this); }
+	~Payload() requires Trivial = default;
+
+	int x;
+};
+
+static_assert(sizeof(Payload< 4, true >) == 4 && sizeof(Payload< 64, true >) == 64 && sizeof(Payload< 256, true >) == 256);
+static_assert(std::is_trivially_copyable_v< Payload< 64, true > > && !std::is_trivially_copyable_v< Payload< 64, false > >);
+
+// ops operations per benchmark iteration, bytes of heap held by size stored elements
+void report(benchmark::State &state, size_t ops, size_t bytes, size_t size)
+{
+	state.SetItemsProcessed(state.iterations() * int64_t(ops));
+	state.counters["time/op"] =
+		benchmark::Counter(double(ops), benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+	state.counters["bytes/element"] = size ? double(bytes) / double(size) : 0.0;
+}
+
+template< typename T >
+void fill(BucketStorage< T > &bs, std::vector< typename BucketStorage< T >::iterator > *positions = nullptr)
+{
+	for (size_t i = 0; i < elements; ++i)
+	{
+		auto it = bs.insert(T(int(i)));
+		if (positions)
+		{
+			positions->push_back(it);
+		}
+	}
+}
+
+// elements inserts into an empty storage
+template< typename T >
+void insert_only(benchmark::State &state)
+{
+	size_t heap_before = heap_bytes;
+	size_t bytes = 0, size = 0;
+	for (auto _ : state)
+	{
+		BucketStorage< T > bs(state.range(0));
+		fill(bs);
+		benchmark::DoNotOptimize(bs.begin());
+		bytes = heap_bytes - heap_before;
+		size = bs.size();
+	}
+	report(state, elements, bytes, size);
+}
+
+// erasing 90% of the elements in random order
+template< typename T >
+void erase_heavy(benchmark::State &state)
+{
+	std::mt19937 rng(0);
+	size_t bytes = 0, size = 0;
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		std::vector< typename BucketStorage< T >::iterator > positions;
+		positions.reserve(elements);
+		size_t heap_before = heap_bytes;
+		auto bs = std::make_unique< BucketStorage< T > >(state.range(0));
+		fill(*bs, &positions);
+		std::shuffle(positions.begin(), positions.end(), rng);
+		positions.resize(elements * 9 / 10);
+		state.ResumeTiming();
+
+		for (auto it : positions)
+		{
+			bs->erase(it);
+		}
+
+		state.PauseTiming();
+		bytes = heap_bytes - heap_before;
+		size = bs->size();
+		bs.reset();
+		state.ResumeTiming();
+	}
+	report(state, elements * 9 / 10, bytes, size);
+}
+
+// a full scan of the storage
+template< typename T >
+void iterate_only(benchmark::State &state)
+{
+	size_t heap_before = heap_bytes;
+	BucketStorage< T > bs(state.range(0));
+	fill(bs);
+	for (auto _ : state)
+	{
+		long long sum = 0;
+		for (auto &value : bs)
+		{
+			sum += value.x;
+		}
+		benchmark::DoNotOptimize(sum);
+	}
+	report(state, elements, heap_bytes - heap_before, bs.size());
+}
+
+// get_to_distance() from begin() to a random position
+template< typename T >
+void random_access(benchmark::State &state)
+{
+	size_t heap_before = heap_bytes;
+	BucketStorage< T > bs(state.range(0));
+	fill(bs);
+	std::mt19937 rng(0);
+	std::uniform_int_distribution< size_t > position(0, elements - 1);
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(bs.get_to_distance(bs.begin(), position(rng)));
+	}
+	report(state, 1, heap_bytes - heap_before, bs.size());
+}
+
+// steady state insert/erase: every op erases a random element and inserts a new one
+template< typename T >
+void mixed_churn(benchmark::State &state)
+{
+	std::vector< typename BucketStorage< T >::iterator > positions;
+	positions.reserve(elements);
+	size_t heap_before = heap_bytes;
+	BucketStorage< T > bs(state.range(0));
+	fill(bs, &positions);
+	std::mt19937 rng(0);
+	std::uniform_int_distribution< size_t > position(0, elements - 1);
+	int next = 0;
+	for (auto _ : state)
+	{
+		auto &it = positions[position(rng)];
+		bs.erase(it);
+		it = bs.insert(T(next++));
+	}
+	report(state, 1, heap_bytes - heap_before, bs.size());
+}
+
+#define BUCKET_STORAGE_BENCHMARK(workload)                                                     \
+	BENCHMARK_TEMPLATE(workload, Payload< 4, true >)->RangeMultiplier(4)->Range(1, 4096);      \
+	BENCHMARK_TEMPLATE(workload, Payload< 4, false >)->RangeMultiplier(4)->Range(1, 4096);     \
+	BENCHMARK_TEMPLATE(workload, Payload< 64, true >)->RangeMultiplier(4)->Range(1, 4096);     \
+	BENCHMARK_TEMPLATE(workload, Payload< 64, false >)->RangeMultiplier(4)->Range(1, 4096);    \
+	BENCHMARK_TEMPLATE(workload, Payload< 256, true >)->RangeMultiplier(4)->Range(1, 4096);    \
+	BENCHMARK_TEMPLATE(workload, Payload< 256, false >)->RangeMultiplier(4)->Range(1, 4096)
+
+BUCKET_STORAGE_BENCHMARK(insert_only);
+BUCKET_STORAGE_BENCHMARK(erase_heavy);
+BUCKET_STORAGE_BENCHMARK(iterate_only);
+BUCKET_STORAGE_BENCHMARK(random_access);
+BUCKET_STORAGE_BENCHMARK(mixed_churn);
+
+BENCHMARK_MAIN();
@@ -4,14 +4,57 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory_resource>
+#include <new>
+#include <mutex>
+#include <numeric>
+#include <optional>
 #include <random>
+#include <ranges>
+#include <span>
+#include <sstream>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #define S_OP_LOGGING 0		 // whether to log S actions
 #define RANDOM_TEST_LOG 0	 // whether to print BS state in random test
 #define STACK_TEST 0		 // enable Stack<T> test
+#define EMPLACE_TEST 0		 // enable emplace()/emplace_hint() tests
+#define RANGE_INSERT_TEST 0	 // enable insert(first, last)/insert_range() tests and benchmark
+#define RANDOM_ACCESS_TEST 0	 // enable random access iterator tests
+#define STATIC_CAPACITY_TEST 0	 // enable BucketStorage<T, N> (compile-time block capacity) tests
+#define ALLOCATOR_TEST 0	 // enable allocator and pmr::BucketStorage<T> tests
+#define HANDLE_TEST 0		 // enable generational handle tests
+#define CONCURRENT_TEST 0	 // enable ConcurrentBucketStorage<T> tests and benchmark
+#define PARALLEL_TEST 0		 // enable parallel_for_each()/parallel_transform_reduce() tests and benchmark
+#define SEGMENTS_TEST 0		 // enable segments() view and segmented algorithm tests
+#define COMPACT_TEST 0		 // enable compact_step()/compact_for() tests
+#define RELOCATE_TEST 0		 // enable is_trivially_relocatable<T> tests and benchmark
+#define RESERVE_TEST 0		 // enable reserve() tests (replaces global operator new)
+#define RETENTION_TEST 0	 // enable set_block_retention() tests and benchmark (replaces global operator new)
+#ifndef STATS_TEST
+#define STATS_TEST 0		 // enable stats() tests (make stats enables them with the lifetime counters)
+#endif
+#define PREFETCH_TEST 0		 // enable set_prefetch_distance() tests and benchmark
+#define INLINE_TEST 0		 // enable SmallBucketStorage<T, InlineN> tests (replaces global operator new)
+#define MERGE_TEST 0		 // enable merge()/splice() tests and benchmark
+#define NODE_TEST 0		 // enable extract()/insert(node_type &&) tests
+#define FREE_LIST_TEST 0	 // enable allocation-free erase() test (replaces global operator new)
+#define CONCURRENT_STACK_TEST 0	 // enable ConcurrentStack<T> tests and benchmark (replaces global operator new)
+#define STACK_BULK_TEST 0	 // enable Stack<T> push_bulk()/pop_bulk()/reserve() tests and benchmark (replaces global operator new)
+
+#if PARALLEL_TEST
+#include <cmath>
+#include <execution>	// libstdc++ needs -ltbb for the parallel policies when TBB is installed (make parallel)
+#endif
 
 /* Warning: tests marked with 'assumes insertion order'
  * test for specific order in BucketStorage, that is,
@@ -118,6 +161,114 @@ class M
 	int *data;
 };
 
+// 64 byte trivially copyable element
+struct Pod
+{
+	int x;
+	char payload[60] = {};
+};
+static_assert(sizeof(Pod) == 64);
+
+#if RELOCATE_TEST
+// M only owns a pointer, so its bytes can be moved without calling constructors
+template<>
+struct is_trivially_relocatable< M > : std::true_type
+{
+};
+
+// counts its constructor and destructor calls, opted in as trivially relocatable
+struct R
+{
+	static int constructions;
+	static int destructions;
+
+	explicit R(int i) : x(i) { ++constructions; }
+	R(const R &r) : x(r.x) { ++constructions; }
+	R(R &&r) noexcept : x(r.x) { ++constructions; }
+	R &operator=(const R &) = default;
+	R &operator=(R &&) = default;
+	~R() { ++destructions; }
+
+	bool operator<(const R &other) const { return x < other.x; }
+	bool operator==(const R &other) const { return x == other.x; }
+
+	int x;
+};
+int R::constructions = 0;
+int R::destructions = 0;
+
+template<>
+struct is_trivially_relocatable< R > : std::true_type
+{
+};
+#endif
+
+#if RESERVE_TEST || RETENTION_TEST || INLINE_TEST || FREE_LIST_TEST || CONCURRENT_STACK_TEST || STACK_BULK_TEST
+// counts global operator new calls while enabled
+class NewCounter
+{
+	static size_t count;
+	static bool enabled;
+
+  public:
+	static void start()
+	{
+		count = 0;
+		enabled = true;
+	}
+	static size_t stop()
+	{
+		enabled = false;
+		return count;
+	}
+	static void on_new()
+	{
+		if (enabled)
+		{
+			++count;
+		}
+	}
+};
+size_t NewCounter::count = 0;
+bool NewCounter::enabled = false;
+
+void *operator new(size_t size)
+{
+	NewCounter::on_new();
+	if (void *ptr = std::malloc(size ? size : 1))
+	{
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+void *operator new(size_t size, std::align_val_t alignment)
+{
+	NewCounter::on_new();
+	size_t align = static_cast< size_t >(alignment);
+	if (void *ptr = std::aligned_alloc(align, (size + align - 1) / align * align))
+	{
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+void operator delete(void *ptr) noexcept
+{
+	std::free(ptr);
+}
+void operator delete(void *ptr, size_t) noexcept
+{
+	std::free(ptr);
+}
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+	std::free(ptr);
+}
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept
+{
+	std::free(ptr);
+}
+#endif
+
 #if STACK_TEST
 TEST(stack, pushpop)
 {
@@ -137,6 +288,171 @@ TEST(stack, pushpop)
 }
 #endif
 
+#if STACK_BULK_TEST
+// push_bulk(span) pushes in span order, pop_bulk(n, out) writes up to n elements
+// in pop order and returns how many were popped
+TEST(stack, bulk)
+{
+	Stack< int > stack;
+	std::vector< int > first{ 1, 2, 3, 4, 5 };
+	stack.push_bulk(std::span< const int >(first));
+	stack.push(6);
+	stack.push_bulk(std::span< const int >());
+	std::vector< int > out;
+	EXPECT_EQ(stack.pop_bulk(2, std::back_inserter(out)), 2);
+	EXPECT_EQ(out, (std::vector< int >{ 6, 5 }));
+	EXPECT_EQ(stack.pop(), 4);
+	out.clear();
+	EXPECT_EQ(stack.pop_bulk(10, std::back_inserter(out)), 3);
+	EXPECT_EQ(out, (std::vector< int >{ 3, 2, 1 }));
+	EXPECT_EQ(stack.pop_bulk(10, std::back_inserter(out)), 0);
+
+	// many chunks
+	std::vector< int > big(1000000);
+	std::iota(big.begin(), big.end(), 0);
+	stack.push_bulk(std::span< const int >(big));
+	stack.push_bulk(std::span< const int >(big.data(), 10));
+	out.clear();
+	EXPECT_EQ(stack.pop_bulk(10, std::back_inserter(out)), 10);
+	EXPECT_EQ(out, (std::vector< int >{ 9, 8, 7, 6, 5, 4, 3, 2, 1, 0 }));
+	out.clear();
+	EXPECT_EQ(stack.pop_bulk(big.size() + 1, std::back_inserter(out)), big.size());
+	std::reverse(out.begin(), out.end());
+	EXPECT_EQ(out, big);
+}
+
+// growing the stack never moves or copies the elements already in it
+TEST(stack, no_relocation)
+{
+	Stack< S > stack;
+	for (int i = 0; i < 10000; ++i)
+	{
+		stack.push(S(i));
+	}
+	EXPECT_EQ(std::count(S::actions.begin(), S::actions.end(), S::LVALUE_COPY_CONSTRUCTOR) +
+				  std::count(S::actions.begin(), S::actions.end(), S::RVALUE_COPY_CONSTRUCTOR),
+			  10000)
+		<< "each element should be constructed in the stack once";
+	EXPECT_EQ(stack.pop().x, 9999);
+}
+
+TEST(stack, reserve)
+{
+	Stack< int > stack;
+	stack.reserve(100000);
+	std::vector< int > values(50000, 1);
+	NewCounter::start();
+	for (int i = 0; i < 50000; ++i)
+	{
+		stack.push(i);
+	}
+	stack.push_bulk(std::span< const int >(values));
+	EXPECT_EQ(NewCounter::stop(), 0) << "pushes up to the reserved size should not allocate";
+	EXPECT_EQ(stack.pop(), 1);
+}
+#endif
+
+#if CONCURRENT_STACK_TEST
+// pop() returns std::nullopt when the stack is empty
+TEST(concurrent_stack, pushpop)
+{
+	ConcurrentStack< int > stack;
+	EXPECT_EQ(stack.pop(), std::nullopt);
+	stack.push(1);
+	stack.push(2);
+	stack.push(3);
+	EXPECT_EQ(stack.pop(), 3);
+	EXPECT_EQ(stack.pop(), 2);
+	stack.push(4);
+	stack.push(5);
+	EXPECT_EQ(stack.pop(), 5);
+	EXPECT_EQ(stack.pop(), 4);
+	EXPECT_EQ(stack.pop(), 1);
+	EXPECT_EQ(stack.pop(), std::nullopt);
+	stack.push(6);
+	stack.push(7);
+}
+
+// every pushed value is popped exactly once
+TEST(concurrent_stack, mpmc)
+{
+	const int producers = 4, consumers = 4, per_producer = 20000;
+	ConcurrentStack< int > stack;
+	std::vector< std::vector< int > > popped(consumers);
+	std::atomic< int > remaining = producers * per_producer;
+
+	std::vector< std::thread > pool;
+	for (int t = 0; t < producers; ++t)
+	{
+		pool.emplace_back(
+			[&, t]()
+			{
+				for (int i = 0; i < per_producer; ++i)
+				{
+					stack.push(t * per_producer + i);
+				}
+			});
+	}
+	for (int t = 0; t < consumers; ++t)
+	{
+		pool.emplace_back(
+			[&, t]()
+			{
+				while (remaining > 0)
+				{
+					if (auto value = stack.pop())
+					{
+						popped[t].push_back(*value);
+						--remaining;
+					}
+				}
+			});
+	}
+	for (auto &thread : pool)
+	{
+		thread.join();
+	}
+	std::vector< int > all;
+	for (auto &values : popped)
+	{
+		all.insert(all.end(), values.begin(), values.end());
+	}
+	std::sort(all.begin(), all.end());
+	ASSERT_EQ(all.size(), size_t(producers * per_producer));
+	for (int i = 0; i < producers * per_producer; ++i)
+	{
+		ASSERT_EQ(all[i], i);
+	}
+	EXPECT_EQ(stack.pop(), std::nullopt);
+}
+
+// nodes are recycled: once warmed up, push() does not allocate
+TEST(concurrent_stack, steady_state_no_allocation)
+{
+	ConcurrentStack< int > stack;
+	for (int i = 0; i < 1000; ++i)
+	{
+		stack.push(i);
+	}
+	while (stack.pop())
+	{
+	}
+	NewCounter::start();
+	for (int round = 0; round < 10; ++round)
+	{
+		for (int i = 0; i < 1000; ++i)
+		{
+			stack.push(i);
+		}
+		for (int i = 0; i < 1000; ++i)
+		{
+			stack.pop();
+		}
+	}
+	EXPECT_EQ(NewCounter::stop(), 0);
+}
+#endif
+
 void print(BucketStorage< S > &bs)
 {
 	for (auto &s : bs)
@@ -315,6 +631,27 @@ auto random_bs_v()
 	return std::make_pair(std::move(bs), std::move(v));
 }
 
+// iterator to a random element of a non-empty storage
+template< typename BS >
+auto random_position(BS &bs)
+{
+	return bs.get_to_distance(bs.begin(), randint(0, int(bs.size() - 1)));
+}
+
+// erases a random element with probability erase_prob, otherwise inserts make()
+template< typename BS, typename Make >
+void random_churn_step(BS &bs, double erase_prob, Make make)
+{
+	if (randdouble() < erase_prob && !bs.empty())
+	{
+		bs.erase(random_position(bs));
+	}
+	else
+	{
+		bs.insert(make());
+	}
+}
+
 TEST(methods, shrink_to_fit)
 {
 	auto [bs, v] = random_bs_v();
@@ -324,71 +661,108 @@ TEST(methods, shrink_to_fit)
 	// std::cout << "after: " << bs.capacity() << '\n';
 	expect_same_elements(bs, v);
 }
-TEST(methods, clear)
-{
-	auto [bs, v] = random_bs_v();
-	expect_same_elements(bs, v);
-	bs.clear();
-	v.clear();
-	EXPECT_EQ(bs.size(), 0);
-	EXPECT_EQ(bs.capacity(), 0) << "By definition, empty bucket storage should deallocate all blocks";
-	expect_same_elements(bs, v);
-}
-
-TEST(methods, get_to_distance)
+#if COMPACT_TEST
+// compact_step(max_moves) moves at most max_moves elements and reports { blocks_freed, elements_moved };
+// the storage stays correct between steps and ends up as compact as after shrink_to_fit()
+TEST(methods, compact_step)
 {
-	BucketStorage< S > bs(10);
-	for (int i = 0; i < 20; ++i)
+	const size_t block_capacity = 8;
+	BucketStorage< S > bs(block_capacity);
+	std::vector< S > v;
+	for (int i = 0; i < 400; ++i)
 	{
-		bs.insert(S(Id::get_id()));
+		insert(bs, v, Id::get_id());
 	}
-	auto it = bs.begin();
-	size_t dist = 11;
-	for (size_t i = 0; i < dist; ++i)
+	for (size_t i = 0; i < v.size(); i++)
 	{
-		++it;
+		if (randdouble() < 0.7)
+		{
+			bs.erase(std::find(bs.begin(), bs.end(), v[i]));
+			v.erase(v.begin() + i);
+		}
 	}
-	EXPECT_EQ(it, bs.get_to_distance(bs.begin(), dist));
+
+	size_t total_moved = 0;
+	for (int step = 0;; ++step)
+	{
+		ASSERT_LT(step, 1000) << "compaction should finish";
+		size_t capacity = bs.capacity();
+		auto progress = bs.compact_step(5);
+		EXPECT_LE(progress.elements_moved, 5);
+		EXPECT_EQ(bs.capacity(), capacity - progress.blocks_freed * block_capacity);
+		EXPECT_EQ(bs.size(), v.size());
+		expect_same_elements(bs, v);
+		total_moved += progress.elements_moved;
+		if (progress.elements_moved == 0 && progress.blocks_freed == 0)
+		{
+			break;
+		}
+		if (step % 10 == 0)
+		{
+			// the storage stays usable between steps
+			insert(bs, v, Id::get_id());
+			bs.erase(std::find(bs.begin(), bs.end(), v.front()));
+			v.erase(v.begin());
+		}
+	}
+	EXPECT_GT(total_moved, 0);
+	EXPECT_EQ(bs.capacity(), (bs.size() + block_capacity - 1) / block_capacity * block_capacity);
+	expect_same_elements(bs, v);
 }
 
-TEST(methods, iterator_operators)
+TEST(methods, compact_for)
 {
-	auto expect_eq = [](BucketStorage< S >::iterator val1, BucketStorage< S >::iterator val2, const char *message)
-	{
-		EXPECT_TRUE(val1 == val2 && !(val1 != val2)) << message;
-	};
-	BucketStorage< S > bs(2);
-	for (int i = 0; i < 5; ++i)
+	auto [bs, v] = random_bs_v();
+	for (int i = 0; i < 100; ++i)
 	{
-		S value = S(Id::get_id());
-		EXPECT_EQ(value, *bs.insert(value)) << "Unary * operator";
-		EXPECT_EQ(value.x, bs.insert(value)->x) << "-> operator";
+		bs.erase(std::find(bs.begin(), bs.end(), v.back()));
+		v.pop_back();
 	}
-	auto it = bs.begin();
-	expect_eq(it++, bs.begin(), "postfix increment operator");
-	EXPECT_TRUE(it >= bs.begin()) << ">= operator";
-	EXPECT_TRUE(it > bs.begin()) << "> operator";
-	expect_eq(++it, ++(++bs.begin()), "prefix increment operator");
-	EXPECT_TRUE(it > ++bs.begin()) << "> operator";
-
-	auto it2 = it;
-	expect_eq(it2--, it, "postfix decrement operator");
-	expect_eq(--it2, bs.begin(), "prefix decrement operator");
+	auto progress = bs.compact_for(std::chrono::microseconds(0));	 // may or may not make progress
+	expect_same_elements(bs, v);
+	int step = 0;
+	do
+	{
+		ASSERT_LT(step++, 1000) << "compaction should finish";
+		progress = bs.compact_for(std::chrono::microseconds(50));
+		expect_same_elements(bs, v);
+	} while (progress.elements_moved != 0 || progress.blocks_freed != 0);
+	BucketStorage< S > shrunk = bs;
+	shrunk.shrink_to_fit();
+	EXPECT_EQ(bs.capacity(), shrunk.capacity());
+
+	BucketStorage< S > empty;
+	progress = empty.compact_for(std::chrono::microseconds(1000));
+	EXPECT_EQ(progress.elements_moved, 0);
+	EXPECT_EQ(progress.blocks_freed, 0);
+}
+#endif
 
-	auto it3 = bs.begin();
-	EXPECT_TRUE(++bs.begin() >= bs.begin()) << ">= operator";
-	EXPECT_FALSE(it3++ > bs.begin()) << "> operator";
+#if RELOCATE_TEST
+TEST(relocate, traits)
+{
+	EXPECT_TRUE(is_trivially_relocatable< int >::value);
+	EXPECT_TRUE(is_trivially_relocatable< Pod >::value) << "trivially copyable types are trivially relocatable";
+	EXPECT_FALSE(is_trivially_relocatable< S >::value);
+	EXPECT_TRUE(is_trivially_relocatable< R >::value);
+	EXPECT_TRUE(is_trivially_relocatable< M >::value);
+}
 
-	for (int i = 1; i <= 20; ++i)
+// relocation should not call any constructors or destructors
+TEST(relocate, shrink_to_fit)
+{
+	BucketStorage< R > bs(7);
+	std::vector< int > v;
+	for (int i = 0; i < 200; ++i)
 	{
-		bs.insert(S(Id::get_id()));
+		bs.insert(R(i));
+		v.push_back(i);
 	}
-
-	it = bs.begin();
-	for (int i = 0; it != bs.end(); ++i)
+	for (auto it = bs.begin(); it != bs.end();)
 	{
-		if (i == 2 || i == 6 || i == 13 || i == 18)
+		if (randdouble() < 0.6)
 		{
+			v.erase(std::find(v.begin(), v.end(), it->x));
 			it = bs.erase(it);
 		}
 		else
@@ -396,258 +770,2287 @@ TEST(methods, iterator_operators)
 			++it;
 		}
 	}
-	it = bs.begin();
-	for (int i = 0; i < 15; ++i)
+	R::constructions = R::destructions = 0;
+	bs.shrink_to_fit();
+	EXPECT_EQ(R::constructions, 0);
+	EXPECT_EQ(R::destructions, 0);
+	std::vector< int > data;
+	for (auto &r : bs)
 	{
-		auto prev = it++;
-		auto next = it;
-		++next;
-		EXPECT_TRUE(it > prev);
-		EXPECT_TRUE(prev < it);
-		EXPECT_TRUE(next > prev);
-		EXPECT_TRUE(prev < next);
-		EXPECT_TRUE(next > it);
-		EXPECT_TRUE(it < next);
-
-		EXPECT_TRUE(it > bs.begin());
-		EXPECT_TRUE(bs.begin() < it);
-		EXPECT_TRUE(bs.end() > it);
-		EXPECT_TRUE(it < bs.end());
-		EXPECT_TRUE(--bs.end() > it);
-		EXPECT_TRUE(it < --bs.end());
+		data.push_back(r.x);
 	}
+	std::sort(data.begin(), data.end());
+	EXPECT_EQ(data, v);
 
-	// expecting these to compile
-	(void)(it == bs.cbegin());
-	(void)(bs.cbegin() == it);
-
-	(void)(it != bs.cbegin());
-	(void)(bs.cbegin() != it);
-
-	(void)(it < bs.cbegin());
-	(void)(bs.cbegin() < it);
-
-	(void)(it >= bs.cbegin());
-	(void)(bs.cbegin() >= it);
-
-	(void)(it > bs.cbegin());
-	(void)(bs.cbegin() > it);
+	// copying still has to copy construct every element
+	BucketStorage< R > copy(bs);
+	EXPECT_EQ(size_t(R::constructions), bs.size());
+	bs.clear();
+	EXPECT_EQ(size_t(R::destructions), copy.size());
+}
 
-	(void)(it <= bs.cbegin());
-	(void)(bs.cbegin() <= it);
+// M owns memory: relocation must neither leak nor double free (compile with -fsanitize=address)
+TEST(relocate, memory_leaks)
+{
+	BucketStorage< M > bs(5);
+	for (int i = 0; i < 300; i++)
+	{
+		bs.insert(M(Id::get_id()));
+		if (randdouble() < 0.4)
+		{
+			bs.erase(random_position(bs));
+		}
+	}
+	BucketStorage< M > copy = bs;
+	bs.shrink_to_fit();
+	copy = std::move(bs);
+	copy.shrink_to_fit();
 }
 
-// assumes insertion order
-TEST(assuming_order, rvalue_insert_erase)
+TEST(relocate, copy_pod)
 {
-	BucketStorage< S > ss(3);
-	for (int i = 1; i <= 10; i++)
+	BucketStorage< Pod > bs(16);
+	for (int i = 0; i < 1000; ++i)
 	{
-		ss.insert(S(i));
-		EXPECT_EQ(S::actions[S::actions.size() - 2], S::RVALUE_COPY_CONSTRUCTOR)
-			<< "rvalue copy constructor should be "
-			   "used\n";
+		Pod pod{ i, {} };
+		pod.payload[i % 60] = char(i);
+		bs.insert(pod);
 	}
+	for (auto it = bs.begin(); it != bs.end();)
 	{
-		int i = 0;
-		for (auto &s : ss)
-		{
-			EXPECT_EQ(s.x, ++i) << "incorrect value\n";
-		}
+		it = it->x % 3 == 0 ? bs.erase(it) : ++it;
+	}
+	BucketStorage< Pod > copy(bs);
+	BucketStorage< Pod > assigned(3);
+	assigned.insert(Pod{ -1, {} });
+	assigned = bs;
+	ASSERT_EQ(copy.size(), bs.size());
+	ASSERT_EQ(assigned.size(), bs.size());
+	auto eq = [](const Pod &a, const Pod &b) { return a.x == b.x && std::memcmp(a.payload, b.payload, sizeof a.payload) == 0; };
+	auto sorted = [](const BucketStorage< Pod > &storage)
+	{
+		std::vector< Pod > data(storage.begin(), storage.end());
+		std::sort(data.begin(), data.end(), [](const Pod &a, const Pod &b) { return a.x < b.x; });
+		return data;
+	};
+	auto expected = sorted(bs);
+	auto copied = sorted(copy);
+	auto assigned_data = sorted(assigned);
+	EXPECT_TRUE(std::equal(expected.begin(), expected.end(), copied.begin(), eq));
+	EXPECT_TRUE(std::equal(expected.begin(), expected.end(), assigned_data.begin(), eq));
+}
+#endif
+
+// swap() exchanges blocks, it should not touch the elements
+TEST(methods, swap_no_element_operations)
+{
+	BucketStorage< S > bs1(3), bs2(5);
+	for (int i = 0; i < 10; ++i)
+	{
+		bs1.insert(S(i));
+		bs2.insert(S(-i));
+	}
+	size_t before = S::actions.size();
+	bs1.swap(bs2);
+	EXPECT_EQ(S::actions.size(), before);
+	EXPECT_EQ(bs1.capacity(), 10);
+	EXPECT_EQ(bs2.capacity(), 12);
+}
+
+TEST(methods, clear)
+{
+	auto [bs, v] = random_bs_v();
+	expect_same_elements(bs, v);
+	bs.clear();
+	v.clear();
+	EXPECT_EQ(bs.size(), 0);
+	EXPECT_EQ(bs.capacity(), 0) << "By definition, empty bucket storage should deallocate all blocks";
+	expect_same_elements(bs, v);
+}
+
+#if RESERVE_TEST
+TEST(methods, reserve)
+{
+	BucketStorage< int > bs(10);
+	bs.reserve(95);
+	EXPECT_EQ(bs.size(), 0);
+	EXPECT_GE(bs.capacity(), 95);
+	EXPECT_EQ(bs.capacity(), 100) << "reserve should allocate only the blocks needed";
+
+	NewCounter::start();
+	for (size_t i = 0; i < 100; ++i)
+	{
+		bs.insert(int(i));
+	}
+	EXPECT_EQ(NewCounter::stop(), 0) << "inserts up to capacity() should not allocate";
+	EXPECT_EQ(bs.capacity(), 100);
+
+	bs.reserve(50);
+	EXPECT_EQ(bs.capacity(), 100) << "reserve below capacity() should do nothing";
+
+	// reserving on a storage with holes
+	for (auto it = bs.begin(); it != bs.end();)
+	{
+		it = *it % 4 == 0 ? bs.erase(it) : ++it;
+	}
+	size_t size = bs.size();
+	bs.reserve(size + 200);
+	EXPECT_GE(bs.capacity(), size + 200);
+	NewCounter::start();
+	while (bs.size() < bs.capacity())
+	{
+		bs.insert(-1);
+	}
+	EXPECT_EQ(NewCounter::stop(), 0) << "inserts up to capacity() should not allocate";
+	EXPECT_EQ(std::count(bs.begin(), bs.end(), -1), bs.capacity() - size);
+}
+
+// free slots left by erase() are reused without allocating, with or without reserve()
+TEST(methods, insert_up_to_capacity)
+{
+	BucketStorage< int > bs(8);
+	for (int i = 0; i < 100; ++i)
+	{
+		bs.insert(i);
+	}
+	for (int i = 0; i < 60; ++i)
+	{
+		bs.erase(random_position(bs));
+	}
+	size_t capacity = bs.capacity();
+	NewCounter::start();
+	while (bs.size() < capacity)
+	{
+		bs.insert(0);
+	}
+	EXPECT_EQ(NewCounter::stop(), 0);
+	EXPECT_EQ(bs.capacity(), capacity);
+}
+#endif
+
+#if RETENTION_TEST
+// inserting and erasing one element across a block boundary
+// should reuse the retained block instead of allocating a new one
+TEST(methods, block_retention_churn)
+{
+	BucketStorage< int > bs(4);
+	bs.set_block_retention(1);
+	for (int i = 0; i < 4; ++i)
+	{
+		bs.insert(i);
+	}
+	bs.erase(bs.insert(4));	 // the first crossing allocates
+	NewCounter::start();
+	for (int i = 0; i < 100; ++i)
+	{
+		auto it = bs.insert(i);
+		EXPECT_EQ(bs.size(), 5);
+		bs.erase(it);
+	}
+	EXPECT_EQ(NewCounter::stop(), 0) << "retained block should be reused";
+	EXPECT_EQ(bs.size(), 4);
+}
+
+TEST(methods, block_retention_limit)
+{
+	auto refill_allocations = [](size_t retention)
+	{
+		BucketStorage< int > bs(4);
+		bs.set_block_retention(retention);
+		for (int i = 0; i < 20; ++i)
+		{
+			bs.insert(i);
+		}
+		for (auto it = bs.begin(); it != bs.end();)
+		{
+			it = bs.erase(it);
+		}
+		EXPECT_TRUE(bs.empty());
+		NewCounter::start();
+		for (int i = 0; i < 20; ++i)
+		{
+			bs.insert(i);
+		}
+		return NewCounter::stop();
+	};
+	NewCounter::start();
+	{
+		BucketStorage< int > bs(4);
+		for (int i = 0; i < 20; ++i)
+		{
+			bs.insert(i);
+		}
+	}
+	size_t fresh = NewCounter::stop();
+	size_t partial = refill_allocations(2);
+	size_t full = refill_allocations(5);
+	EXPECT_GT(fresh, 0);
+	EXPECT_LT(partial, fresh) << "up to 2 emptied blocks should be kept";
+	EXPECT_GT(partial, 0) << "no more than 2 emptied blocks should be kept";
+	EXPECT_EQ(full, 0) << "all 5 emptied blocks should be kept";
+}
+
+// clear() keeps its meaning: retained blocks are not part of capacity()
+TEST(methods, block_retention_clear)
+{
+	auto [bs, v] = random_bs_v();
+	bs.set_block_retention(100);
+	bs.clear();
+	EXPECT_EQ(bs.size(), 0);
+	EXPECT_EQ(bs.capacity(), 0);
+	for (int i = 0; i < 10; ++i)
+	{
+		bs.insert(S(i));
+	}
+	EXPECT_EQ(bs.size(), 10);
+	bs.set_block_retention(0);	  // releases the pool
+	bs.clear();
+	EXPECT_EQ(bs.capacity(), 0);
+}
+#endif
+
+#if STATS_TEST
+// checks that stats() agrees with size() and capacity()
+void expect_consistent_stats(const BucketStorage< S > &bs, size_t block_capacity)
+{
+	auto stats = bs.stats();
+	EXPECT_EQ(stats.live_slots, bs.size());
+	EXPECT_EQ(stats.live_slots + stats.dead_slots, bs.capacity());
+	EXPECT_EQ(stats.blocks * block_capacity, bs.capacity());
+	ASSERT_EQ(stats.occupancy_histogram.size(), block_capacity + 1) << "one bucket per possible block population";
+	size_t blocks = 0, live = 0;
+	for (size_t i = 0; i <= block_capacity; ++i)
+	{
+		blocks += stats.occupancy_histogram[i];
+		live += i * stats.occupancy_histogram[i];
+	}
+	EXPECT_EQ(blocks, stats.blocks);
+	EXPECT_EQ(live, stats.live_slots);
+	EXPECT_EQ(stats.bytes_used, bs.size() * sizeof(S));
+	EXPECT_GE(stats.bytes_reserved, bs.capacity() * sizeof(S));
+	if (bs.capacity() == 0)
+	{
+		EXPECT_EQ(stats.fragmentation, 0.0);
+	}
+	else
+	{
+		EXPECT_DOUBLE_EQ(stats.fragmentation, double(stats.dead_slots) / bs.capacity());
+	}
+}
+
+TEST(stats, layout)
+{
+	BucketStorage< S > bs(4);
+	auto stats = bs.stats();
+	EXPECT_EQ(stats.blocks, 0);
+	EXPECT_EQ(stats.live_slots, 0);
+	EXPECT_EQ(stats.dead_slots, 0);
+	EXPECT_EQ(stats.fragmentation, 0.0);
+
+	for (int i = 0; i < 10; ++i)
+	{
+		bs.insert(S(i));
+	}
+	stats = bs.stats();
+	EXPECT_EQ(stats.blocks, 3);
+	EXPECT_EQ(stats.live_slots, 10);
+	EXPECT_EQ(stats.dead_slots, 2);
+	EXPECT_EQ(stats.occupancy_histogram[4], 2);
+	EXPECT_EQ(stats.occupancy_histogram[2], 1);
+	expect_consistent_stats(bs, 4);
+
+	for (size_t capacity : { 1, 3, 20 })
+	{
+		BucketStorage< S > random(capacity);
+		for (int i = 0; i < 300; ++i)
+		{
+			random_churn_step(random, 0.4, [] { return S(Id::get_id()); });
+			if (i % 25 == 0)
+			{
+				expect_consistent_stats(random, capacity);
+			}
+		}
+		random.shrink_to_fit();
+		expect_consistent_stats(random, capacity);
+		random.clear();
+		expect_consistent_stats(random, capacity);
+	}
+}
+
+#if BUCKET_STORAGE_STATS
+TEST(stats, lifetime_counters)
+{
+	BucketStorage< S > bs(4);
+	for (int i = 0; i < 8; ++i)
+	{
+		bs.insert(S(i));
+	}
+	auto stats = bs.stats();
+	EXPECT_EQ(stats.allocations, 2);
+	EXPECT_EQ(stats.frees, 0);
+	EXPECT_EQ(stats.reuses, 0);
+
+	bs.erase(bs.begin());
+	bs.insert(S(8));
+	stats = bs.stats();
+	EXPECT_EQ(stats.allocations, 2);
+	EXPECT_EQ(stats.reuses, 1) << "the erased slot should be reused";
+
+	bs.clear();
+	stats = bs.stats();
+	EXPECT_EQ(stats.allocations, 2);
+	EXPECT_EQ(stats.frees, 2);
+}
+#endif
+#endif
+
+#if FREE_LIST_TEST
+// erase() should never allocate, whatever the erase order
+TEST(methods, erase_no_allocation)
+{
+	S::actions.reserve(100000);	   // logging should not allocate either
+	BucketStorage< S > bs(16);
+	for (int i = 0; i < 1000; ++i)
+	{
+		bs.insert(S(i));
+	}
+	NewCounter::start();
+	for (auto it = bs.begin(); it != bs.end();)
+	{
+		it = it->x % 3 == 0 ? bs.erase(it) : ++it;
+	}
+	while (bs.size() > 100)
+	{
+		bs.erase(random_position(bs));
+	}
+	while (!bs.empty())
+	{
+		bs.erase(--bs.end());
+	}
+	EXPECT_EQ(NewCounter::stop(), 0) << "erase should not allocate";
+}
+
+// elements smaller than a slot index and over-aligned elements
+// (a free list kept inside dead slots has to fit in both)
+template< typename T >
+void churn_small_and_aligned(size_t capacity)
+{
+	BucketStorage< T > bs(capacity);
+	std::vector< int > v;
+	for (int i = 0; i < 2000; ++i)
+	{
+		if (randdouble() < 0.45 && !bs.empty())
+		{
+			auto it = random_position(bs);
+			v.erase(std::find(v.begin(), v.end(), int(it->x)));
+			bs.erase(it);
+		}
+		else
+		{
+			T value{};
+			value.x = decltype(value.x)(i % 100);
+			EXPECT_EQ(reinterpret_cast< std::uintptr_t >(&*bs.insert(value)) % alignof(T), 0);
+			v.push_back(i % 100);
+		}
+	}
+	std::vector< int > data;
+	for (auto &value : bs)
+	{
+		data.push_back(value.x);
+	}
+	std::sort(data.begin(), data.end());
+	std::sort(v.begin(), v.end());
+	EXPECT_EQ(data, v);
+}
+
+struct Tiny
+{
+	char x;
+};
+
+struct alignas(64) Aligned
+{
+	int x;
+};
+
+TEST(methods, small_and_aligned_elements)
+{
+	for (size_t capacity : { 1, 3, 64, 300 })
+	{
+		churn_small_and_aligned< Tiny >(capacity);
+		churn_small_and_aligned< Aligned >(capacity);
+	}
+}
+#endif
+
+TEST(methods, get_to_distance)
+{
+	BucketStorage< S > bs(10);
+	for (int i = 0; i < 20; ++i)
+	{
+		bs.insert(S(Id::get_id()));
+	}
+	auto it = bs.begin();
+	size_t dist = 11;
+	for (size_t i = 0; i < dist; ++i)
+	{
+		++it;
+	}
+	EXPECT_EQ(it, bs.get_to_distance(bs.begin(), dist));
+}
+
+// iteration over storages where most slots (and whole blocks) are dead,
+// with block capacities around 64-bit word boundaries
+TEST(methods, sparse_iteration)
+{
+	for (size_t capacity : { 1, 2, 63, 64, 65, 128, 130, 1000 })
+	{
+		BucketStorage< S > bs(capacity);
+		std::vector< S > v;
+		const int base = Id::get_id();
+		for (int i = 0; i < 3000; ++i)
+		{
+			insert(bs, v, Id::get_id());
+		}
+		std::vector< S > kept;
+		for (auto it = bs.begin(); it != bs.end();)
+		{
+			// keeps a sparse pattern with long runs of dead slots
+			const int k = it->x - base;
+			if ((k % 97 == 0 || k % 1000 < 3) && !(k > 1000 && k < 2200))
+			{
+				kept.push_back(*it++);
+			}
+			else
+			{
+				it = bs.erase(it);
+			}
+		}
+		ASSERT_EQ(bs.size(), kept.size()) << "block capacity " << capacity;
+		expect_same_elements(kept, bs);
+
+		std::vector< int > forward, backward;
+		for (auto it = bs.cbegin(); it != bs.cend(); ++it)
+		{
+			forward.push_back(it->x);
+		}
+		for (auto it = bs.cend(); it != bs.cbegin();)
+		{
+			backward.push_back((--it)->x);
+		}
+		std::reverse(backward.begin(), backward.end());
+		EXPECT_EQ(forward, backward) << "block capacity " << capacity;
+
+		while (bs.size() > 1)
+		{
+			bs.erase(bs.begin());
+		}
+		EXPECT_EQ(++bs.begin(), bs.end()) << "block capacity " << capacity;
+		EXPECT_EQ(--bs.end(), bs.begin()) << "block capacity " << capacity;
+	}
+}
+
+#if PREFETCH_TEST
+// prefetching the next block must not change iteration, even at the last block
+TEST(methods, prefetch_distance)
+{
+	for (size_t capacity : { 1, 2, 16, 64 })
+	{
+		for (size_t distance : { size_t(0), size_t(1), capacity / 2, capacity, capacity + 1 })
+		{
+			BucketStorage< S > bs(capacity);
+			bs.set_prefetch_distance(distance);
+			std::vector< int > expected;
+			for (int i = 0; i < 100; ++i)
+			{
+				bs.insert(S(i));
+			}
+			for (auto it = bs.begin(); it != bs.end();)
+			{
+				if (it->x % 3 == 0 || (it->x > 40 && it->x < 70))
+				{
+					it = bs.erase(it);
+				}
+				else
+				{
+					expected.push_back((it++)->x);
+				}
+			}
+			std::vector< int > forward, backward;
+			for (auto &s : bs)
+			{
+				forward.push_back(s.x);
+			}
+			for (auto it = bs.end(); it != bs.begin();)
+			{
+				backward.push_back((--it)->x);
+			}
+			std::reverse(backward.begin(), backward.end());
+			EXPECT_EQ(forward, expected) << "capacity " << capacity << ", distance " << distance;
+			EXPECT_EQ(backward, expected) << "capacity " << capacity << ", distance " << distance;
+		}
+	}
+}
+#endif
+
+// get_to_distance should stay consistent with ++ through insert(), erase() and shrink_to_fit()
+TEST(methods, get_to_distance_random)
+{
+	BucketStorage< S > bs(7);
+	auto check = [&]()
+	{
+		ASSERT_EQ(bs.get_to_distance(bs.begin(), 0), bs.begin());
+		auto it = bs.begin();
+		for (size_t i = 0; i < bs.size(); ++i, ++it)
+		{
+			ASSERT_EQ(bs.get_to_distance(bs.begin(), i), it) << "distance " << i;
+			size_t rest = randint(0, int(bs.size() - i));
+			auto expected = it;
+			for (size_t j = 0; j < rest; ++j)
+			{
+				++expected;
+			}
+			ASSERT_EQ(bs.get_to_distance(it, rest), expected) << "distance " << rest << " from " << i;
+		}
+		EXPECT_EQ(bs.get_to_distance(bs.begin(), bs.size()), bs.end());
+	};
+
+	for (int i = 0; i < 300; ++i)
+	{
+		random_churn_step(bs, 0.4, [] { return S(Id::get_id()); });
+		if (i % 50 == 0)
+		{
+			check();
+		}
+	}
+	check();
+	bs.shrink_to_fit();
+	check();
+	while (bs.size() > 10)
+	{
+		bs.erase(random_position(bs));
+	}
+	check();
+}
+
+TEST(methods, iterator_operators)
+{
+	auto expect_eq = [](BucketStorage< S >::iterator val1, BucketStorage< S >::iterator val2, const char *message)
+	{
+		EXPECT_TRUE(val1 == val2 && !(val1 != val2)) << message;
+	};
+	BucketStorage< S > bs(2);
+	for (int i = 0; i < 5; ++i)
+	{
+		S value = S(Id::get_id());
+		EXPECT_EQ(value, *bs.insert(value)) << "Unary * operator";
+		EXPECT_EQ(value.x, bs.insert(value)->x) << "-> operator";
+	}
+	auto it = bs.begin();
+	expect_eq(it++, bs.begin(), "postfix increment operator");
+	EXPECT_TRUE(it >= bs.begin()) << ">= operator";
+	EXPECT_TRUE(it > bs.begin()) << "> operator";
+	expect_eq(++it, ++(++bs.begin()), "prefix increment operator");
+	EXPECT_TRUE(it > ++bs.begin()) << "> operator";
+
+	auto it2 = it;
+	expect_eq(it2--, it, "postfix decrement operator");
+	expect_eq(--it2, bs.begin(), "prefix decrement operator");
+
+	auto it3 = bs.begin();
+	EXPECT_TRUE(++bs.begin() >= bs.begin()) << ">= operator";
+	EXPECT_FALSE(it3++ > bs.begin()) << "> operator";
+
+	for (int i = 1; i <= 20; ++i)
+	{
+		bs.insert(S(Id::get_id()));
+	}
+
+	it = bs.begin();
+	for (int i = 0; it != bs.end(); ++i)
+	{
+		if (i == 2 || i == 6 || i == 13 || i == 18)
+		{
+			it = bs.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	it = bs.begin();
+	for (int i = 0; i < 15; ++i)
+	{
+		auto prev = it++;
+		auto next = it;
+		++next;
+		EXPECT_TRUE(it > prev);
+		EXPECT_TRUE(prev < it);
+		EXPECT_TRUE(next > prev);
+		EXPECT_TRUE(prev < next);
+		EXPECT_TRUE(next > it);
+		EXPECT_TRUE(it < next);
+
+		EXPECT_TRUE(it > bs.begin());
+		EXPECT_TRUE(bs.begin() < it);
+		EXPECT_TRUE(bs.end() > it);
+		EXPECT_TRUE(it < bs.end());
+		EXPECT_TRUE(--bs.end() > it);
+		EXPECT_TRUE(it < --bs.end());
+	}
+
+	// expecting these to compile
+	(void)(it == bs.cbegin());
+	(void)(bs.cbegin() == it);
+
+	(void)(it != bs.cbegin());
+	(void)(bs.cbegin() != it);
+
+	(void)(it < bs.cbegin());
+	(void)(bs.cbegin() < it);
+
+	(void)(it >= bs.cbegin());
+	(void)(bs.cbegin() >= it);
+
+	(void)(it > bs.cbegin());
+	(void)(bs.cbegin() > it);
+
+	(void)(it <= bs.cbegin());
+	(void)(bs.cbegin() <= it);
+}
+
+#if RANDOM_ACCESS_TEST
+TEST(typing, random_access_iterator)
+{
+	EXPECT_TRUE(std::random_access_iterator< BucketStorage< S >::iterator >);
+	EXPECT_TRUE(std::random_access_iterator< BucketStorage< S >::const_iterator >);
+	EXPECT_TRUE((std::totally_ordered_with< BucketStorage< S >::iterator, BucketStorage< S >::const_iterator >));
+	EXPECT_TRUE((std::sized_sentinel_for< BucketStorage< S >::const_iterator, BucketStorage< S >::iterator >));
+}
+
+TEST(methods, random_access_operators)
+{
+	BucketStorage< S > bs(4);
+	std::vector< S > v;
+	for (int i = 0; i < 60; ++i)
+	{
+		insert(bs, v, Id::get_id());
+	}
+	for (auto it = bs.begin(); it != bs.end();)
+	{
+		if (randdouble() < 0.3)
+		{
+			it = bs.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	std::vector< BucketStorage< S >::iterator > walk;	 // every valid position, end() included
+	for (auto it = bs.begin(); it != bs.end(); ++it)
+	{
+		walk.push_back(it);
+	}
+	walk.push_back(bs.end());
+	using diff = BucketStorage< S >::difference_type;
+	const diff n = diff(bs.size());
+	ASSERT_EQ(bs.end() - bs.begin(), n);
+	ASSERT_EQ(std::distance(bs.cbegin(), bs.cend()), n);
+
+	for (diff i = 0; i <= n; ++i)
+	{
+		for (diff j = 0; j <= n; ++j)
+		{
+			ASSERT_EQ(walk[i] + (j - i), walk[j]) << i << " + " << j - i;
+			ASSERT_EQ((j - i) + walk[i], walk[j]) << j - i << " + " << i;
+			ASSERT_EQ(walk[i] - (i - j), walk[j]) << i << " - " << i - j;
+			ASSERT_EQ(walk[j] - walk[i], j - i) << j << " - " << i;
+			auto it = walk[i];
+			ASSERT_EQ(it += (j - i), walk[j]);
+			ASSERT_EQ(it -= (j - i), walk[i]);
+			if (j < n)
+			{
+				ASSERT_EQ(walk[i][j - i], *walk[j]) << i << "[" << j - i << "]";
+			}
+		}
+	}
+	BucketStorage< S >::const_iterator cit = bs.begin() + 5;
+	EXPECT_EQ(cit - bs.begin(), 5);
+	EXPECT_EQ(bs.end() - cit, n - 5);
+}
+
+TEST(methods, random_access_algorithms)
+{
+	BucketStorage< int > bs(5);
+	for (int i = 0; i < 200; ++i)
+	{
+		bs.insert(randint(0, 1000));
+	}
+	for (auto it = bs.begin(); it != bs.end();)
+	{
+		it = randdouble() < 0.2 ? bs.erase(it) : it + 1;
+	}
+	std::vector< int > v(bs.begin(), bs.end());
+
+	auto mid = bs.begin() + bs.size() / 2;
+	std::nth_element(bs.begin(), mid, bs.end());
+	std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+	EXPECT_EQ(*mid, v[v.size() / 2]);
+
+	std::sort(bs.begin(), bs.end());
+	std::sort(v.begin(), v.end());
+	EXPECT_TRUE(std::equal(bs.begin(), bs.end(), v.begin(), v.end()));
+	for (int x : { -1, 0, 250, 500, 999, 1001 })
+	{
+		EXPECT_EQ(std::lower_bound(bs.begin(), bs.end(), x) - bs.begin(), std::lower_bound(v.begin(), v.end(), x) - v.begin());
+	}
+	auto pp = std::partition_point(bs.cbegin(), bs.cend(), [](int x) { return x < 500; });
+	EXPECT_EQ(pp - bs.cbegin(), std::partition_point(v.begin(), v.end(), [](int x) { return x < 500; }) - v.begin());
+}
+#endif
+
+#if HANDLE_TEST
+TEST(typing, handle)
+{
+	using handle = BucketStorage< S >::handle;
+	EXPECT_EQ(sizeof(handle), 8);
+	EXPECT_TRUE(std::is_trivially_copyable_v< handle >);
+	EXPECT_TRUE(std::regular< handle >);
+
+	BucketStorage< S > bs;
+	const BucketStorage< S > &const_bs = bs;
+	EXPECT_TRUE((std::same_as< decltype(bs.get(handle())), S * >));
+	EXPECT_TRUE((std::same_as< decltype(const_bs.get(handle())), const S * >));
+	EXPECT_EQ(bs.get(handle()), nullptr) << "default constructed handle should be null\n";
+}
+
+TEST(methods, handle)
+{
+	BucketStorage< S > bs(4);
+	std::vector< std::pair< BucketStorage< S >::handle, int > > live;
+	std::vector< BucketStorage< S >::handle > stale;
+	auto check = [&]()
+	{
+		for (auto &[h, x] : live)
+		{
+			S *p = bs.get(h);
+			ASSERT_NE(p, nullptr);
+			ASSERT_EQ(p->x, x);
+		}
+		for (auto h : stale)
+		{
+			ASSERT_EQ(bs.get(h), nullptr) << "stale handle should not resolve\n";
+		}
+	};
+
+	for (int i = 0; i < 500; ++i)
+	{
+		double r = randdouble();
+		if (r <= 0.2 && !live.empty())
+		{
+			size_t index = randint(0, int(live.size() - 1));
+			auto [h, x] = live[index];
+			if (r <= 0.1)
+			{
+				bs.erase(h);
+			}
+			else
+			{
+				// erasing through an iterator invalidates the handle as well
+				bs.erase(std::find(bs.begin(), bs.end(), S(x)));
+			}
+			live.erase(live.begin() + index);
+			stale.push_back(h);
+		}
+		else
+		{
+			int x = Id::get_id();
+			auto h = bs.insert_with_handle(S(x));
+			EXPECT_EQ(bs.get(h)->x, x);
+			live.emplace_back(h, x);
+		}
+		EXPECT_EQ(bs.size(), live.size());
+	}
+	check();
+
+	bs.get(live.front().first)->x = -1;
+	live.front().second = -1;
+	EXPECT_NE(std::find(bs.begin(), bs.end(), S(-1)), bs.end()) << "get() should point into the storage\n";
+
+	// slots of erased elements get reused, but old handles must stay stale
+	for (int i = 0; i < 100; ++i)
+	{
+		int x = Id::get_id();
+		live.emplace_back(bs.insert_with_handle(S(x)), x);
+	}
+	check();
+
+	bs.clear();
+	for (auto &[h, x] : live)
+	{
+		EXPECT_EQ(bs.get(h), nullptr);
+	}
+}
+
+// a handle may be invalidated by shrink_to_fit(), but never refers to another element
+TEST(methods, handle_shrink_to_fit)
+{
+	BucketStorage< S > bs(4);
+	std::vector< std::pair< BucketStorage< S >::handle, int > > handles;
+	for (int i = 0; i < 100; ++i)
+	{
+		int x = Id::get_id();
+		handles.emplace_back(bs.insert_with_handle(S(x)), x);
+	}
+	for (size_t i = 0; i < handles.size(); i += 3)
+	{
+		bs.erase(handles[i].first);
+	}
+	bs.shrink_to_fit();
+	for (size_t i = 0; i < handles.size(); ++i)
+	{
+		const S *p = bs.get(handles[i].first);
+		if (i % 3 == 0)
+		{
+			EXPECT_EQ(p, nullptr);
+		}
+		else if (p != nullptr)
+		{
+			EXPECT_EQ(p->x, handles[i].second);
+		}
+	}
+}
+#endif
+
+#if MERGE_TEST
+// merge() takes over the other storage's blocks: no element is constructed, moved or destroyed
+TEST(methods, merge)
+{
+	auto [bs1, v1] = random_bs_v();
+	auto [bs2, v2] = random_bs_v();
+	std::vector< const S * > addresses;
+	for (auto &s : bs2)
+	{
+		addresses.push_back(&s);
+	}
+	size_t size = bs1.size() + bs2.size();
+	size_t capacity = bs1.capacity() + bs2.capacity();
+
+	size_t before = S::actions.size();
+	bs1.merge(std::move(bs2));
+	EXPECT_EQ(S::actions.size(), before) << "merge should not touch the elements\n";
+	EXPECT_EQ(bs1.size(), size);
+	EXPECT_EQ(bs1.capacity(), capacity);
+	EXPECT_TRUE(bs2.empty());
+	EXPECT_EQ(bs2.capacity(), 0);
+
+	v1.insert(v1.end(), v2.begin(), v2.end());
+	expect_same_elements(bs1, v1);
+	for (const S *address : addresses)
+	{
+		EXPECT_NE(std::find_if(bs1.begin(), bs1.end(), [&](const S &s) { return &s == address; }), bs1.end())
+			<< "merged elements should keep their addresses\n";
+	}
+
+	// free slots of both storages are reused before allocating
+	while (bs1.size() < capacity)
+	{
+		insert(bs1, v1, Id::get_id());
+	}
+	EXPECT_EQ(bs1.capacity(), capacity);
+	for (int i = 0; i < 30; ++i)
+	{
+		bs1.erase(std::find(bs1.begin(), bs1.end(), v1.back()));
+		v1.pop_back();
+	}
+	expect_same_elements(bs1, v1);
+}
+
+TEST(methods, splice)
+{
+	BucketStorage< S > bs1(5), bs2(5);
+	std::vector< S > v;
+	for (int i = 0; i < 12; ++i)
+	{
+		insert(bs1, v, Id::get_id());
+		insert(bs2, v, Id::get_id());
+	}
+	size_t before = S::actions.size();
+	bs1.splice(bs2);
+	EXPECT_EQ(S::actions.size(), before) << "splice should not touch the elements\n";
+	EXPECT_EQ(bs1.size(), 24);
+	EXPECT_EQ(bs1.capacity(), 30);
+	EXPECT_TRUE(bs2.empty());
+	expect_same_elements(bs1, v);
+
+	// the other storage stays usable
+	std::vector< S > v2;
+	insert(bs2, v2, Id::get_id());
+	expect_same_elements(bs2, v2);
+
+	BucketStorage< S > empty(5);
+	bs1.splice(empty);
+	EXPECT_EQ(bs1.size(), 24);
+	empty.splice(bs1);
+	EXPECT_EQ(empty.size(), 24);
+	EXPECT_TRUE(bs1.empty());
+	expect_same_elements(empty, v);
+}
+
+// storages with different block capacities still merge correctly
+TEST(methods, merge_different_capacity)
+{
+	BucketStorage< S > bs1(3), bs2(7);
+	std::vector< S > v;
+	for (int i = 0; i < 20; ++i)
+	{
+		insert(i % 2 ? bs1 : bs2, v, Id::get_id());
+	}
+	bs1.merge(std::move(bs2));
+	EXPECT_EQ(bs1.size(), 20);
+	expect_same_elements(bs1, v);
+}
+#endif
+
+#if NODE_TEST
+TEST(node_handle, typing)
+{
+	using node_type = BucketStorage< S >::node_type;
+	EXPECT_TRUE(std::is_default_constructible_v< node_type >);
+	EXPECT_TRUE(std::is_nothrow_move_constructible_v< node_type >);
+	EXPECT_TRUE(std::is_nothrow_move_assignable_v< node_type >);
+	EXPECT_FALSE(std::is_copy_constructible_v< node_type >);
+	EXPECT_TRUE(node_type().empty());
+	EXPECT_FALSE(bool(node_type()));
+}
+
+// moving an element between storages never copies it
+// and moves it once from the node handle into the destination slot
+TEST(node_handle, extract_insert)
+{
+	BucketStorage< S > from(4), to(3);
+	std::vector< S > v_from, v_to;
+	for (int i = 0; i < 10; ++i)
+	{
+		insert(from, v_from, Id::get_id());
+		insert(to, v_to, Id::get_id());
+	}
+	for (int i = 0; i < 5; ++i)
+	{
+		auto it = random_position(from);
+		int x = it->x;
+		size_t before_extract = S::actions.size();
+		auto node = from.extract(it);
+		EXPECT_FALSE(node.empty());
+		EXPECT_EQ(node.value().x, x);
+		EXPECT_EQ(from.size(), v_from.size() - 1);
+		EXPECT_EQ(std::find(from.begin(), from.end(), S(x)), from.end()) << "extracted element should leave the storage\n";
+
+		size_t before_insert = S::actions.size();
+		auto inserted = to.insert(std::move(node));
+		EXPECT_TRUE(node.empty());
+		EXPECT_EQ(inserted->x, x);
+		EXPECT_EQ(std::count(S::actions.begin() + before_extract, S::actions.end(), S::LVALUE_COPY_CONSTRUCTOR), 0);
+		EXPECT_EQ(std::count(S::actions.begin() + before_insert, S::actions.end(), S::RVALUE_COPY_CONSTRUCTOR), 1)
+			<< "the element should be moved once into the destination slot\n";
+
+		v_from.erase(std::find(v_from.begin(), v_from.end(), S(x)));
+		v_to.emplace_back(x);
+		expect_same_elements(from, v_from);
+		expect_same_elements(to, v_to);
+	}
+
+	BucketStorage< S >::node_type empty;
+	EXPECT_EQ(to.insert(std::move(empty)), to.end());
+	EXPECT_EQ(to.size(), v_to.size());
+}
+
+// records the values it is destroyed with, moved-from objects are not recorded
+struct Tracked
+{
+	static std::vector< int > destroyed;
+
+	explicit Tracked(int i) : x(i) {}
+	Tracked(const Tracked &) = default;
+	Tracked(Tracked &&t) noexcept : x(std::exchange(t.x, -1)) {}
+	Tracked &operator=(const Tracked &) = default;
+	Tracked &operator=(Tracked &&t) noexcept
+	{
+		x = std::exchange(t.x, -1);
+		return *this;
+	}
+	~Tracked()
+	{
+		if (x >= 0)
+		{
+			destroyed.push_back(x);
+		}
+	}
+
+	int x;
+};
+std::vector< int > Tracked::destroyed;
+
+TEST(node_handle, ownership)
+{
+	BucketStorage< Tracked > tracked(4);
+	for (int i = 0; i < 6; ++i)
+	{
+		tracked.insert(Tracked(i));
+	}
+	{
+		auto node = tracked.extract(tracked.begin());
+		auto other = std::move(node);
+		EXPECT_TRUE(node.empty());
+		EXPECT_FALSE(other.empty());
+		int held = other.value().x;
+		Tracked::destroyed.clear();
+		other = tracked.extract(tracked.begin());	 // destroys the previously held element
+		EXPECT_EQ(Tracked::destroyed, std::vector< int >{ held });
+	}
+	EXPECT_EQ(tracked.size(), 4);
+
+	BucketStorage< S > bs(4);
+	for (int i = 0; i < 4; ++i)
+	{
+		bs.insert(S(i));
+	}
+
+	// a node handle may outlive the storage it was extracted from
+	BucketStorage< S >::node_type node;
+	{
+		BucketStorage< S > temporary(2);
+		temporary.insert(S(100));
+		temporary.insert(S(101));
+		node = temporary.extract(std::find(temporary.begin(), temporary.end(), S(101)));
+	}
+	EXPECT_EQ(node.value().x, 101);
+	EXPECT_EQ(bs.insert(std::move(node))->x, 101);
+	EXPECT_EQ(bs.size(), 5);
+}
+
+// compile with -fsanitize=address
+TEST(node_handle, memory_leaks)
+{
+	BucketStorage< M > a(3), b(5);
+	for (int i = 0; i < 30; ++i)
+	{
+		a.insert(M(i));
+	}
+	for (int i = 0; i < 200; ++i)
+	{
+		auto &from = i % 2 ? a : b;
+		auto &to = i % 2 ? b : a;
+		if (from.empty())
+		{
+			continue;
+		}
+		auto node = from.extract(random_position(from));
+		if (i % 7 != 0)
+		{
+			to.insert(std::move(node));
+		}
+	}
+	auto node = a.empty() ? BucketStorage< M >::node_type() : a.extract(a.begin());
+	a.clear();
+}
+
+#if RELOCATE_TEST
+// trivially relocatable elements move between storages without any constructor or destructor
+TEST(node_handle, trivially_relocatable)
+{
+	BucketStorage< R > from(4), to(4);
+	for (int i = 0; i < 10; ++i)
+	{
+		from.insert(R(i));
+	}
+	R::constructions = R::destructions = 0;
+	for (int i = 0; i < 5; ++i)
+	{
+		to.insert(from.extract(from.begin()));
+	}
+	EXPECT_EQ(R::constructions, 0);
+	EXPECT_EQ(R::destructions, 0);
+	EXPECT_EQ(from.size(), 5);
+	EXPECT_EQ(to.size(), 5);
+}
+#endif
+#endif
+
+// assumes insertion order
+TEST(assuming_order, rvalue_insert_erase)
+{
+	BucketStorage< S > ss(3);
+	for (int i = 1; i <= 10; i++)
+	{
+		ss.insert(S(i));
+		EXPECT_EQ(S::actions[S::actions.size() - 2], S::RVALUE_COPY_CONSTRUCTOR)
+			<< "rvalue copy constructor should be "
+			   "used\n";
+	}
+	{
+		int i = 0;
+		for (auto &s : ss)
+		{
+			EXPECT_EQ(s.x, ++i) << "incorrect value\n";
+		}
 	}
 	{
 		auto it = ss.end();
 		int i = 10;
 		while (!ss.empty())
 		{
-			--it;
-			EXPECT_EQ(it->x, i--) << "incorrect value\n";
-			it = ss.erase(it);
+			--it;
+			EXPECT_EQ(it->x, i--) << "incorrect value\n";
+			it = ss.erase(it);
+		}
+	}
+}
+
+// assumes insertion order
+TEST(assuming_order, lvalue_insert)
+{
+	BucketStorage< S > ss(3);
+	for (int i = 1; i <= 10; i++)
+	{
+		S s(i);
+		ss.insert(s);
+		EXPECT_EQ(S::actions.back(), S::LVALUE_COPY_CONSTRUCTOR) << "expected lvalue copy constructor\n";
+	}
+	int i = 0;
+	for (auto &s : ss)
+	{
+		EXPECT_EQ(s.x, ++i) << "incorrect value\n";
+	}
+}
+
+#if EMPLACE_TEST
+// emplace() should construct the element in its slot:
+// exactly one S constructor call and no temporaries
+TEST(methods, emplace)
+{
+	BucketStorage< S > ss(3);
+	for (int i = 1; i <= 10; i++)
+	{
+		size_t before = S::actions.size();
+		auto it = ss.emplace(i);
+		EXPECT_EQ(it->x, i) << "emplace should return an iterator to the new element\n";
+		ASSERT_EQ(S::actions.size(), before + 1) << "emplace should not create intermediate objects\n";
+		EXPECT_EQ(S::actions.back(), S::CONSTRUCTOR) << "expected in-place construction\n";
+	}
+	EXPECT_EQ(ss.size(), 10);
+}
+
+TEST(methods, emplace_hint)
+{
+	BucketStorage< S > ss(3);
+	std::vector< S > v;
+	for (int i = 0; i < 9; i++)
+	{
+		insert(ss, v, Id::get_id());
+	}
+	auto erase_at = [&](size_t index)
+	{
+		auto it = std::find(ss.begin(), ss.end(), v[index]);
+		v.erase(v.begin() + index);
+		return ss.erase(it);
+	};
+	erase_at(4);
+	auto hint = erase_at(1);
+
+	size_t before = S::actions.size();
+	int x = Id::get_id();
+	auto it = ss.emplace_hint(hint, x);
+	EXPECT_EQ(it->x, x);
+	ASSERT_EQ(S::actions.size(), before + 1) << "emplace_hint should not create intermediate objects\n";
+	EXPECT_EQ(S::actions.back(), S::CONSTRUCTOR) << "expected in-place construction\n";
+	v.emplace_back(x);
+
+	// any hint is valid, including end()
+	x = Id::get_id();
+	EXPECT_EQ(ss.emplace_hint(ss.cend(), x)->x, x);
+	v.emplace_back(x);
+	x = Id::get_id();
+	EXPECT_EQ(ss.emplace_hint(ss.cend(), x)->x, x);
+	v.emplace_back(x);
+
+	EXPECT_EQ(ss.size(), v.size());
+	expect_same_elements(ss, v);
+}
+
+// assumes the hint is honoured when the hinted block has a free slot
+TEST(assuming_order, emplace_hint_block)
+{
+	BucketStorage< S > ss(3);
+	for (int i = 1; i <= 9; i++)
+	{
+		ss.emplace(i);
+	}
+	ss.erase(ss.get_to_distance(ss.begin(), 1));	// free a slot in the first block
+	auto hint = ss.erase(ss.get_to_distance(ss.begin(), 6));	// and one in the third block
+
+	auto it = ss.emplace_hint(hint, 10);
+	EXPECT_EQ(it->x, 10);
+	EXPECT_TRUE(it > std::find(ss.begin(), ss.end(), S(7))) << "element should be placed in the hinted block\n";
+	EXPECT_TRUE(it < std::find(ss.begin(), ss.end(), S(9))) << "element should be placed in the hinted block\n";
+}
+#endif
+
+#if RANGE_INSERT_TEST
+TEST(methods, range_insert)
+{
+	std::vector< S > v;
+	for (int i = 0; i < 50; ++i)
+	{
+		v.emplace_back(Id::get_id());
+	}
+	BucketStorage< S > bs(7);
+	size_t before = S::actions.size();
+	bs.insert(v.begin(), v.end());
+	EXPECT_EQ(bs.size(), v.size());
+	EXPECT_EQ(bs.capacity(), 56) << "all needed blocks should be allocated up front\n";
+	ASSERT_EQ(S::actions.size(), before + v.size()) << "range insert should not create intermediate objects\n";
+	EXPECT_TRUE(std::all_of(S::actions.begin() + before, S::actions.end(), [](const char *a) { return a == S::LVALUE_COPY_CONSTRUCTOR; }));
+
+	// inserting into a storage with holes
+	std::vector< S > w;
+	for (int i = 0; i < 10; ++i)
+	{
+		w.emplace_back(Id::get_id());
+	}
+	bs.erase(bs.get_to_distance(bs.begin(), 3));
+	v.erase(v.begin() + 3);
+	bs.insert(std::make_move_iterator(w.begin()), std::make_move_iterator(w.end()));
+	v.insert(v.end(), w.begin(), w.end());
+	EXPECT_EQ(bs.size(), v.size());
+	expect_same_elements(bs, v);
+}
+
+TEST(methods, insert_range)
+{
+	BucketStorage< int > bs(16);
+	bs.insert_range(std::views::iota(0, 100));
+	EXPECT_EQ(bs.size(), 100);
+	EXPECT_EQ(bs.capacity(), 112);
+
+	// a single-pass range of unknown size
+	std::istringstream in("100 101 102 103 104");
+	bs.insert(std::istream_iterator< int >(in), std::istream_iterator< int >());
+	EXPECT_EQ(bs.size(), 105);
+
+	std::vector< int > sorted(bs.begin(), bs.end());
+	std::sort(sorted.begin(), sorted.end());
+	for (int i = 0; i < 105; ++i)
+	{
+		EXPECT_EQ(sorted[i], i);
+	}
+
+	bs.insert_range(std::vector< int >());
+	EXPECT_EQ(bs.size(), 105);
+}
+
+// assumes insertion order
+TEST(assuming_order, range_insert)
+{
+	std::vector< S > v;
+	for (int i = 1; i <= 10; ++i)
+	{
+		v.emplace_back(i);
+	}
+	BucketStorage< S > ss(3);
+	ss.insert_range(v);
+	int i = 0;
+	for (auto &s : ss)
+	{
+		EXPECT_EQ(s.x, ++i) << "incorrect value\n";
+	}
+	EXPECT_EQ(i, 10);
+}
+#endif
+
+// assumes insertion order
+TEST(assuming_order, RAII)
+{
+	BucketStorage< S > bs_lvalue;
+	bs_lvalue.insert(S(1));
+	bs_lvalue.insert(S(2));
+
+	bs_lvalue = BucketStorage< S >(2);	  // rvalue assignment
+	bs_lvalue.insert(S(3));
+	bs_lvalue.insert(S(4));
+	bs_lvalue.insert(S(5));
+	EXPECT_EQ(bs_lvalue.size(), 3);
+	EXPECT_EQ(bs_lvalue.capacity(), 4);
+	EXPECT_EQ(bs_lvalue.begin()->x, 3);
+	EXPECT_EQ((++(++bs_lvalue.begin()))->x, 5);
+
+	BucketStorage< S > bs_copy(bs_lvalue);	  // lvalue copy constructor
+	EXPECT_EQ(bs_copy.size(), 3);
+	EXPECT_EQ(bs_copy.capacity(), 4);
+	EXPECT_EQ(bs_copy.begin()->x, 3);
+	EXPECT_EQ((++(++bs_lvalue.begin()))->x, 5);
+
+	bs_lvalue = bs_lvalue;	  // self assignment
+	EXPECT_EQ(bs_lvalue.size(), 3);
+	EXPECT_EQ(bs_lvalue.capacity(), 4);
+	EXPECT_EQ(bs_lvalue.begin()->x, 3);
+	EXPECT_EQ((++(++bs_lvalue.begin()))->x, 5);
+
+	BucketStorage< S > bs_rvalue_constructed(BucketStorage< S >(20));
+	bs_rvalue_constructed.insert(S(1));
+	EXPECT_EQ(bs_rvalue_constructed.size(), 1);
+	EXPECT_EQ(bs_rvalue_constructed.capacity(), 20);
+	EXPECT_EQ(bs_rvalue_constructed.begin()->x, 1);
+}
+
+// assumes insertion order
+TEST(assuming_order, block_capacity_extremes2)
+{
+	BucketStorage< S > ss(2);
+	EXPECT_EQ(ss.insert(S(1))->x, 1);
+	EXPECT_EQ(ss.insert(S(2))->x, 2);
+	EXPECT_EQ(ss.insert(S(3))->x, 3);
+
+	auto it = ss.begin();
+	EXPECT_EQ((it++)->x, 1);
+	EXPECT_EQ((it++)->x, 2);
+	EXPECT_EQ((it++)->x, 3);
+}
+
+// assumes insertion order
+TEST(assuming_order, block_capacity_extremes1)
+{
+	BucketStorage< S > ss1(1);
+	EXPECT_EQ(ss1.insert(S(1))->x, 1);
+	EXPECT_EQ(ss1.insert(S(2))->x, 2);
+	EXPECT_EQ(ss1.insert(S(3))->x, 3);
+
+	auto it = ss1.begin();
+	EXPECT_EQ((it++)->x, 1);
+	EXPECT_EQ((it++)->x, 2);
+	EXPECT_EQ((it++)->x, 3);
+	EXPECT_EQ(it, ss1.end());
+}
+
+TEST(typing, cbegin)
+{
+	const BucketStorage< S > const_bs;
+	EXPECT_TRUE((std::same_as< decltype(const_bs.begin()), BucketStorage< S >::const_iterator >))
+		<< "begin() should have a "
+		   "const overload that "
+		   "returns const_iterator";
+	EXPECT_TRUE((std::same_as< decltype(const_bs.end()), BucketStorage< S >::const_iterator >))
+		<< "end() should have a "
+		   "const overload that "
+		   "returns const_iterator";
+	BucketStorage< S > bs;
+	EXPECT_TRUE((std::same_as< decltype(bs.begin()), BucketStorage< S >::iterator >));
+	EXPECT_TRUE((std::same_as< decltype(bs.end()), BucketStorage< S >::iterator >));
+
+	EXPECT_TRUE((std::same_as< decltype(bs.cbegin()), BucketStorage< S >::const_iterator >));
+	EXPECT_TRUE((std::same_as< decltype(bs.cend()), BucketStorage< S >::const_iterator >));
+
+	{
+		BucketStorage< S >::const_iterator const_it = bs.begin();	 // implicit conversion
+		(void)const_it;
+	}
+
+	// BucketStorage< S >::iterator it(const_it);	   // should not compile
+	bs.insert(S(78));
+	BucketStorage< S >::iterator b = bs.begin();
+	BucketStorage< S >::iterator it = b;
+	EXPECT_EQ(*b, *it);
+
+	BucketStorage< S >::const_iterator cb = bs.cbegin();
+	BucketStorage< S >::const_iterator const_it = cb;
+	EXPECT_EQ(*cb, *const_it);
+
+	// it = cb; // should not compile
+	cb = it;
+	EXPECT_EQ(*cb, *it);
+
+	std::cout << *it << '\n';
+	std::cout << *const_it << '\n';
+}
+
+TEST(typing, const_bs)
+{
+	const BucketStorage< S > const_bs;
+	for (auto &s : const_bs)
+	{
+		(void)s;
+	}
+	BucketStorage< S > bs = const_bs;
+	bs.insert(S(1));
+	const auto it = bs.begin();
+	EXPECT_EQ(it->x, 1);
+}
+
+template< class ContainerType >
+concept Container = requires(ContainerType a, const ContainerType b) {
+	requires std::semiregular< ContainerType >;
+	requires std::swappable< ContainerType >;
+	requires std::destructible< typename ContainerType::value_type >;
+	requires std::same_as< typename ContainerType::reference, typename ContainerType::value_type & >;
+	requires std::same_as< typename ContainerType::const_reference, const typename ContainerType::value_type & >;
+	requires std::forward_iterator< typename ContainerType::iterator >;
+	requires std::forward_iterator< typename ContainerType::const_iterator >;
+	requires std::signed_integral< typename ContainerType::difference_type >;
+	requires std::same_as< typename ContainerType::difference_type, typename std::iterator_traits< typename ContainerType::iterator >::difference_type >;
+	requires std::same_as< typename ContainerType::difference_type, typename std::iterator_traits< typename ContainerType::const_iterator >::difference_type >;
+	{ a.begin() } -> std::same_as< typename ContainerType::iterator >;
+	{ a.end() } -> std::same_as< typename ContainerType::iterator >;
+	{ b.begin() } -> std::same_as< typename ContainerType::const_iterator >;
+	{ b.end() } -> std::same_as< typename ContainerType::const_iterator >;
+	{ a.cbegin() } -> std::same_as< typename ContainerType::const_iterator >;
+	{ a.cend() } -> std::same_as< typename ContainerType::const_iterator >;
+	{ a.size() } -> std::same_as< typename ContainerType::size_type >;
+	/*
+	{
+		// maybe we don't really need this
+		// unless you find a sensible way to calculate this
+		a.max_size()
+	} -> std::same_as< typename ContainerType::size_type >;
+	*/
+	{ a.empty() } -> std::same_as< bool >;
+};
+template< Container C >
+void container_f(C c)
+{
+	(void)c;
+}
+
+TEST(typing, concepts)
+{
+	EXPECT_TRUE(std::is_default_constructible< BucketStorage< S > >());
+	EXPECT_TRUE(std::is_copy_assignable< BucketStorage< S > >());
+	EXPECT_TRUE(std::is_move_assignable< BucketStorage< S > >());
+	EXPECT_TRUE(std::copy_constructible< BucketStorage< S > >);
+	EXPECT_TRUE(std::move_constructible< BucketStorage< S > >);
+	EXPECT_TRUE(std::destructible< BucketStorage< S > >);
+
+	EXPECT_TRUE(Container< BucketStorage< S > >);
+	// container_f(BucketStorage< S >());	  // uncomment to see why it's failing
+}
+
+#if STATIC_CAPACITY_TEST
+// performs the same random operations on BucketStorage< S, N > and BucketStorage< S >(N)
+template< size_t N >
+void expect_same_as_dynamic()
+{
+	BucketStorage< S, N > static_bs;
+	BucketStorage< S > dynamic_bs(N);
+	auto sorted = [](auto &bs)
+	{
+		std::vector< int > data;
+		for (auto &s : bs)
+		{
+			data.push_back(s.x);
+		}
+		std::sort(data.begin(), data.end());
+		return data;
+	};
+	for (int i = 0; i < 500; ++i)
+	{
+		if (randdouble() <= 0.3 && !dynamic_bs.empty())
+		{
+			auto it = random_position(dynamic_bs);
+			static_bs.erase(std::find(static_bs.begin(), static_bs.end(), *it));
+			dynamic_bs.erase(it);
+		}
+		else
+		{
+			int x = Id::get_id();
+			static_bs.insert(S(x));
+			dynamic_bs.insert(S(x));
+		}
+		ASSERT_EQ(static_bs.size(), dynamic_bs.size()) << "N = " << N;
+		ASSERT_EQ(static_bs.capacity(), dynamic_bs.capacity()) << "N = " << N;
+	}
+	EXPECT_EQ(sorted(static_bs), sorted(dynamic_bs)) << "N = " << N;
+
+	BucketStorage< S, N > copy = static_bs;
+	static_bs.shrink_to_fit();
+	EXPECT_EQ(static_bs.capacity() % N, 0) << "N = " << N;
+	EXPECT_EQ(sorted(static_bs), sorted(copy)) << "N = " << N;
+	copy.clear();
+	EXPECT_EQ(copy.capacity(), 0) << "N = " << N;
+	copy.swap(static_bs);
+	EXPECT_EQ(sorted(copy), sorted(dynamic_bs)) << "N = " << N;
+}
+
+TEST(static_capacity, random)
+{
+	expect_same_as_dynamic< 1 >();
+	expect_same_as_dynamic< 3 >();
+	expect_same_as_dynamic< 8 >();
+	expect_same_as_dynamic< 64 >();
+	expect_same_as_dynamic< 100 >();
+}
+
+TEST(static_capacity, concepts)
+{
+	EXPECT_TRUE((Container< BucketStorage< S, 16 > >));
+	EXPECT_TRUE((Container< BucketStorage< M, 5 > >));
+	EXPECT_TRUE((std::is_same_v< decltype(BucketStorage< S, 16 >().begin()), BucketStorage< S, 16 >::iterator >));
+}
+
+// assumes insertion order
+TEST(static_capacity, insertion_order)
+{
+	BucketStorage< S, 2 > ss;
+	for (int i = 1; i <= 5; ++i)
+	{
+		EXPECT_EQ(ss.insert(S(i))->x, i);
+		EXPECT_EQ(ss.capacity(), size_t(i + 1) / 2 * 2);
+	}
+	int i = 0;
+	for (auto &s : ss)
+	{
+		EXPECT_EQ(s.x, ++i) << "incorrect value\n";
+	}
+}
+#endif
+
+#if ALLOCATOR_TEST
+TEST(typing, allocator_type)
+{
+	EXPECT_TRUE((std::same_as< BucketStorage< S >::allocator_type, std::allocator< S > >));
+}
+
+// memory resource that counts what goes through it
+class CountingResource : public std::pmr::memory_resource
+{
+  public:
+	size_t allocations = 0;
+	size_t deallocations = 0;
+	size_t bytes_in_use = 0;
+
+  private:
+	void *do_allocate(size_t bytes, size_t alignment) override
+	{
+		++allocations;
+		bytes_in_use += bytes;
+		return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+	}
+	void do_deallocate(void *p, size_t bytes, size_t alignment) override
+	{
+		++deallocations;
+		bytes_in_use -= bytes;
+		std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+	}
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+};
+
+// installs a counting default resource for the duration of a test
+class DefaultResourceGuard
+{
+  public:
+	DefaultResourceGuard() : previous(std::pmr::set_default_resource(&resource)) {}
+	~DefaultResourceGuard() { std::pmr::set_default_resource(previous); }
+
+	CountingResource resource;
+
+  private:
+	std::pmr::memory_resource *previous;
+};
+
+TEST(allocator, pmr_resource)
+{
+	DefaultResourceGuard global;
+	CountingResource res;
+	{
+		pmr::BucketStorage< S > bs(20, &res);
+		EXPECT_EQ(bs.get_allocator().resource(), &res);
+		for (int i = 0; i < 100; ++i)
+		{
+			bs.insert(S(Id::get_id()));
+		}
+		EXPECT_GE(res.allocations, 5) << "blocks should be allocated from the resource\n";
+		for (auto it = bs.begin(); it != bs.end();)
+		{
+			it = bs.erase(it);
+		}
+		bs.shrink_to_fit();
+	}
+	EXPECT_EQ(res.bytes_in_use, 0) << "all blocks should be returned to the resource\n";
+	EXPECT_EQ(global.resource.allocations, 0) << "the default resource should not be used\n";
+}
+
+TEST(allocator, pmr_monotonic)
+{
+	alignas(std::max_align_t) std::byte buffer[1 << 14];
+	std::pmr::monotonic_buffer_resource arena(buffer, sizeof buffer, std::pmr::null_memory_resource());
+	pmr::BucketStorage< int > bs(16, &arena);
+	for (int i = 0; i < 500; ++i)
+	{
+		bs.insert(i);
+	}
+	EXPECT_EQ(bs.size(), 500);
+	EXPECT_EQ(std::accumulate(bs.begin(), bs.end(), 0), 499 * 500 / 2);
+}
+
+// elements are constructed with the storage's allocator (uses-allocator construction)
+TEST(allocator, pmr_uses_allocator)
+{
+	DefaultResourceGuard global;
+	CountingResource res;
+	{
+		pmr::BucketStorage< std::pmr::vector< int > > bs(4, &res);
+		std::pmr::vector< int > v(32, 7, std::pmr::new_delete_resource());
+		bs.insert(v);
+		bs.insert(std::move(v));
+		bs.insert(std::pmr::vector< int >(16, 1, std::pmr::new_delete_resource()));
+		for (auto &element : bs)
+		{
+			EXPECT_EQ(element.get_allocator().resource(), &res);
+		}
+		pmr::BucketStorage< std::pmr::string > strings(4, &res);
+		strings.insert(std::pmr::string(100, 'x', std::pmr::new_delete_resource()));
+		EXPECT_EQ(strings.begin()->get_allocator().resource(), &res);
+	}
+	EXPECT_EQ(res.bytes_in_use, 0);
+	EXPECT_EQ(global.resource.allocations, 0) << "the default resource should not be used\n";
+}
+
+// polymorphic_allocator does not propagate on copy assignment, move assignment or swap
+TEST(allocator, pmr_propagation)
+{
+	CountingResource res1, res2;
+	pmr::BucketStorage< S > bs1(4, &res1);
+	pmr::BucketStorage< S > bs2(4, &res2);
+	std::vector< S > v;
+	for (int i = 0; i < 10; ++i)
+	{
+		v.emplace_back(Id::get_id());
+		bs1.insert(v.back());
+	}
+
+	bs2 = bs1;
+	EXPECT_EQ(bs2.get_allocator().resource(), &res2);
+	EXPECT_GT(res2.bytes_in_use, 0);
+	EXPECT_EQ(bs2.size(), v.size());
+
+	pmr::BucketStorage< S > copy(bs1);
+	EXPECT_EQ(copy.get_allocator().resource(), std::pmr::get_default_resource()) << "select_on_container_copy_construction\n";
+
+	pmr::BucketStorage< S > moved(std::move(bs1));
+	EXPECT_EQ(moved.get_allocator().resource(), &res1);
+	EXPECT_EQ(moved.size(), v.size());
+
+	// unequal allocators: elements are moved one by one into res2's blocks
+	size_t res2_allocations = res2.allocations;
+	bs2.clear();
+	bs2 = std::move(moved);
+	EXPECT_EQ(bs2.get_allocator().resource(), &res2);
+	EXPECT_GT(res2.allocations, res2_allocations);
+	EXPECT_EQ(bs2.size(), v.size());
+
+	pmr::BucketStorage< S > other(4, &res2);
+	other.insert(S(-1));
+	bs2.swap(other);
+	EXPECT_EQ(other.size(), v.size());
+	EXPECT_EQ(bs2.size(), 1);
+	EXPECT_EQ(bs2.begin()->x, -1);
+}
+
+#if STATIC_CAPACITY_TEST
+// stateful allocator with configurable propagation traits
+template< typename T, bool Propagate >
+struct TaggedAllocator
+{
+	using value_type = T;
+	using propagate_on_container_copy_assignment = std::bool_constant< Propagate >;
+	using propagate_on_container_move_assignment = std::bool_constant< Propagate >;
+	using propagate_on_container_swap = std::bool_constant< Propagate >;
+	using is_always_equal = std::false_type;
+
+	template< typename U >
+	struct rebind
+	{
+		using other = TaggedAllocator< U, Propagate >;
+	};
+
+	explicit TaggedAllocator(int tag) : tag(tag) {}
+	template< typename U >
+	TaggedAllocator(const TaggedAllocator< U, Propagate > &other) : tag(other.tag)
+	{
+	}
+
+	T *allocate(size_t n) { return std::allocator< T >().allocate(n); }
+	void deallocate(T *p, size_t n) { std::allocator< T >().deallocate(p, n); }
+
+	template< typename U >
+	bool operator==(const TaggedAllocator< U, Propagate > &other) const
+	{
+		return tag == other.tag;
+	}
+
+	int tag;
+};
+
+TEST(allocator, propagation)
+{
+	using Propagating = TaggedAllocator< S, true >;
+	using BS = BucketStorage< S, 4, Propagating >;
+	EXPECT_TRUE((std::same_as< BS::allocator_type, Propagating >));
+
+	BS bs1{ Propagating(1) }, bs2{ Propagating(2) };
+	bs1.insert(S(1));
+	bs2 = bs1;
+	EXPECT_EQ(bs2.get_allocator().tag, 1) << "propagate_on_container_copy_assignment\n";
+
+	BS bs3{ Propagating(3) };
+	bs3 = std::move(bs2);
+	EXPECT_EQ(bs3.get_allocator().tag, 1) << "propagate_on_container_move_assignment\n";
+	EXPECT_EQ(bs3.begin()->x, 1);
+
+	BS bs4{ Propagating(4) };
+	bs4.swap(bs3);
+	EXPECT_EQ(bs4.get_allocator().tag, 1) << "propagate_on_container_swap\n";
+	EXPECT_EQ(bs3.get_allocator().tag, 4) << "propagate_on_container_swap\n";
+	EXPECT_EQ(bs4.begin()->x, 1);
+	EXPECT_TRUE(bs3.empty());
+}
+
+TEST(allocator, no_propagation)
+{
+	using Sticky = TaggedAllocator< S, false >;
+	using BS = BucketStorage< S, 4, Sticky >;
+
+	BS bs1{ Sticky(1) }, bs2{ Sticky(2) };
+	for (int i = 1; i <= 10; ++i)
+	{
+		bs1.insert(S(i));
+	}
+	bs2 = bs1;
+	EXPECT_EQ(bs2.get_allocator().tag, 2);
+	EXPECT_EQ(bs2.size(), 10);
+
+	BS bs3{ Sticky(3) };
+	size_t before = S::actions.size();
+	bs3 = std::move(bs2);
+	EXPECT_EQ(bs3.get_allocator().tag, 3);
+	EXPECT_EQ(bs3.size(), 10);
+	EXPECT_EQ(std::count(S::actions.begin() + before, S::actions.end(), S::RVALUE_COPY_CONSTRUCTOR), 10)
+		<< "unequal allocators: elements should be moved one by one\n";
+
+	BS bs4{ Sticky(1) };
+	bs4.insert(S(0));
+	bs4.swap(bs1);	  // equal allocators
+	EXPECT_EQ(bs4.size(), 10);
+	EXPECT_EQ(bs1.size(), 1);
+}
+#endif
+#endif
+
+#if CONCURRENT_TEST
+// Note: S is not thread safe (S::actions), so these tests store ints
+
+// every thread inserts its own elements, then erases elements inserted by other threads
+TEST(concurrent, insert_erase)
+{
+	const int threads = 8;
+	const int per_thread = 5000;
+	ConcurrentBucketStorage< int > cbs(16);
+	std::vector< std::vector< ConcurrentBucketStorage< int >::iterator > > inserted(threads);
+	std::atomic< int > ready = 0;
+
+	auto insert_worker = [&](int t)
+	{
+		for (int i = 0; i < per_thread; ++i)
+		{
+			inserted[t].push_back(cbs.insert(t * per_thread + i));
+			size_t size = cbs.size();
+			EXPECT_GE(size, 1);
+			EXPECT_LE(size, size_t(threads * per_thread));
+		}
+		++ready;
+	};
+	// erases every other element of the next thread
+	auto erase_worker = [&](int t)
+	{
+		auto &victims = inserted[(t + 1) % threads];
+		for (size_t i = 0; i < victims.size(); i += 2)
+		{
+			cbs.erase(victims[i]);
 		}
+	};
+
+	std::vector< std::thread > pool;
+	for (int t = 0; t < threads; ++t)
+	{
+		pool.emplace_back(insert_worker, t);
+	}
+	for (auto &thread : pool)
+	{
+		thread.join();
+	}
+	ASSERT_EQ(ready, threads);
+	ASSERT_EQ(cbs.size(), size_t(threads * per_thread));
+
+	pool.clear();
+	for (int t = 0; t < threads; ++t)
+	{
+		pool.emplace_back(erase_worker, t);
+	}
+	for (auto &thread : pool)
+	{
+		thread.join();
+	}
+	ASSERT_EQ(cbs.size(), size_t(threads * per_thread / 2));
+
+	std::vector< int > data(cbs.begin(), cbs.end());
+	std::sort(data.begin(), data.end());
+	std::vector< int > expected;
+	for (int x = 1; x < threads * per_thread; x += 2)
+	{
+		expected.push_back(x);
 	}
+	EXPECT_EQ(data, expected);
 }
 
-// assumes insertion order
-TEST(assuming_order, lvalue_insert)
+// inserts and erases interleaved across threads: every thread hands some of its elements
+// to the next thread, which erases them while their owner keeps inserting and reusing slots
+TEST(concurrent, churn)
 {
-	BucketStorage< S > ss(3);
-	for (int i = 1; i <= 10; i++)
+	const int threads = 4;
+	const int rounds = 2000;
+	using Entry = std::pair< ConcurrentBucketStorage< int >::iterator, int >;
+	ConcurrentBucketStorage< int > cbs(8);
+	std::vector< std::atomic< long long > > sums(threads);
+	std::vector< std::atomic< long long > > sizes(threads);
+	std::vector< std::vector< Entry > > inbox(threads);
+	std::vector< std::mutex > inbox_mutex(threads);
+
+	std::vector< std::thread > pool;
+	for (int t = 0; t < threads; ++t)
 	{
-		S s(i);
-		ss.insert(s);
-		EXPECT_EQ(S::actions.back(), S::LVALUE_COPY_CONSTRUCTOR) << "expected lvalue copy constructor\n";
+		pool.emplace_back(
+			[&, t]()
+			{
+				std::mt19937 local_rng(seed + t);
+				std::vector< Entry > mine;
+				long long sum = 0, size = 0;
+				for (int i = 0; i < rounds; ++i)
+				{
+					std::vector< Entry > remote;
+					{
+						std::lock_guard< std::mutex > lock(inbox_mutex[t]);
+						remote.swap(inbox[t]);
+					}
+					for (auto [it, x] : remote)
+					{
+						sum -= x;
+						--size;
+						cbs.erase(it);	  // remote erase
+					}
+
+					unsigned r = local_rng() % 4;
+					if (r == 0 && !mine.empty())
+					{
+						size_t index = local_rng() % mine.size();
+						sum -= mine[index].second;
+						--size;
+						cbs.erase(mine[index].first);
+						mine.erase(mine.begin() + index);
+					}
+					else
+					{
+						int x = t * rounds + i;
+						sum += x;
+						++size;
+						Entry entry(cbs.insert(x), x);
+						if (r == 1)
+						{
+							std::lock_guard< std::mutex > lock(inbox_mutex[(t + 1) % threads]);
+							inbox[(t + 1) % threads].push_back(entry);
+						}
+						else
+						{
+							mine.push_back(entry);
+						}
+					}
+				}
+				sums[t] = sum;
+				sizes[t] = size;
+			});
 	}
-	int i = 0;
-	for (auto &s : ss)
+	for (auto &thread : pool)
 	{
-		EXPECT_EQ(s.x, ++i) << "incorrect value\n";
+		thread.join();
 	}
+	long long expected = 0, expected_size = 0;
+	for (int t = 0; t < threads; ++t)
+	{
+		expected += sums[t];
+		expected_size += sizes[t];
+	}
+	EXPECT_EQ(cbs.size(), size_t(expected_size));
+	EXPECT_EQ(std::accumulate(cbs.begin(), cbs.end(), 0LL), expected);
 }
+#endif
 
-// assumes insertion order
-TEST(assuming_order, RAII)
+#if PARALLEL_TEST
+// storage with holes and empty blocks, and a vector of the same elements
+auto random_int_bs_v(size_t capacity, int n)
 {
-	BucketStorage< S > bs_lvalue;
-	bs_lvalue.insert(S(1));
-	bs_lvalue.insert(S(2));
+	BucketStorage< int > bs(capacity);
+	for (int i = 0; i < n; ++i)
+	{
+		bs.insert(i);
+	}
+	for (auto it = bs.begin(); it != bs.end();)
+	{
+		if (randdouble() < 0.3 || (*it > n / 3 && *it < n / 2))
+		{
+			it = bs.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	std::vector< int > v(bs.begin(), bs.end());
+	return std::make_pair(std::move(bs), std::move(v));
+}
 
-	bs_lvalue = BucketStorage< S >(2);	  // rvalue assignment
-	bs_lvalue.insert(S(3));
-	bs_lvalue.insert(S(4));
-	bs_lvalue.insert(S(5));
-	EXPECT_EQ(bs_lvalue.size(), 3);
-	EXPECT_EQ(bs_lvalue.capacity(), 4);
-	EXPECT_EQ(bs_lvalue.begin()->x, 3);
-	EXPECT_EQ((++(++bs_lvalue.begin()))->x, 5);
+TEST(parallel, for_each)
+{
+	for (size_t capacity : { 1, 7, 64, 1000 })
+	{
+		auto [bs, v] = random_int_bs_v(capacity, 20000);
+		parallel_for_each(bs, [](int &x) { x = x * 2 + 1; });
+		std::vector< int > result(bs.begin(), bs.end());
+		for (int &x : v)
+		{
+			x = x * 2 + 1;
+		}
+		std::sort(result.begin(), result.end());
+		std::sort(v.begin(), v.end());
+		EXPECT_EQ(result, v) << "block capacity " << capacity << ": every element should be visited exactly once";
+	}
 
-	BucketStorage< S > bs_copy(bs_lvalue);	  // lvalue copy constructor
-	EXPECT_EQ(bs_copy.size(), 3);
-	EXPECT_EQ(bs_copy.capacity(), 4);
-	EXPECT_EQ(bs_copy.begin()->x, 3);
-	EXPECT_EQ((++(++bs_lvalue.begin()))->x, 5);
+	BucketStorage< int > empty;
+	parallel_for_each(empty, [](int &) { FAIL() << "no elements to visit"; });
+}
 
-	bs_lvalue = bs_lvalue;	  // self assignment
-	EXPECT_EQ(bs_lvalue.size(), 3);
-	EXPECT_EQ(bs_lvalue.capacity(), 4);
-	EXPECT_EQ(bs_lvalue.begin()->x, 3);
-	EXPECT_EQ((++(++bs_lvalue.begin()))->x, 5);
+TEST(parallel, transform_reduce)
+{
+	for (size_t capacity : { 1, 7, 64, 1000 })
+	{
+		auto [bs, v] = random_int_bs_v(capacity, 20000);
+		const BucketStorage< int > &const_bs = bs;
+		long long expected = 0;
+		for (int x : v)
+		{
+			expected += (long long)x * x;
+		}
+		auto square = [](const int &x) { return (long long)x * x; };
+		EXPECT_EQ(parallel_transform_reduce(const_bs, 0LL, std::plus<>(), square), expected) << "block capacity " << capacity;
+		EXPECT_EQ(parallel_transform_reduce(bs, 5LL, std::plus<>(), square), expected + 5) << "block capacity " << capacity;
+	}
 
-	BucketStorage< S > bs_rvalue_constructed(BucketStorage< S >(20));
-	bs_rvalue_constructed.insert(S(1));
-	EXPECT_EQ(bs_rvalue_constructed.size(), 1);
-	EXPECT_EQ(bs_rvalue_constructed.capacity(), 20);
-	EXPECT_EQ(bs_rvalue_constructed.begin()->x, 1);
+	BucketStorage< int > empty;
+	EXPECT_EQ(parallel_transform_reduce(empty, 42, std::plus<>(), [](int x) { return x; }), 42);
 }
 
-// assumes insertion order
-TEST(assuming_order, block_capacity_extremes2)
+TEST(parallel, thread_pool)
 {
-	BucketStorage< S > ss(2);
-	EXPECT_EQ(ss.insert(S(1))->x, 1);
-	EXPECT_EQ(ss.insert(S(2))->x, 2);
-	EXPECT_EQ(ss.insert(S(3))->x, 3);
+	auto [bs, v] = random_int_bs_v(16, 10000);
+	long long expected = std::accumulate(v.begin(), v.end(), 0LL);
+	for (size_t threads : { 1, 2, 3, 8 })
+	{
+		ThreadPool pool(threads);
+		EXPECT_EQ(pool.size(), threads);
+		EXPECT_EQ(parallel_transform_reduce(pool, bs, 0LL, std::plus<>(), [](int x) { return (long long)x; }), expected);
+		std::atomic< long long > sum = 0;
+		parallel_for_each(pool, bs, [&](int x) { sum += x; });
+		EXPECT_EQ(sum, expected);
+	}
+}
 
-	auto it = ss.begin();
-	EXPECT_EQ((it++)->x, 1);
-	EXPECT_EQ((it++)->x, 2);
-	EXPECT_EQ((it++)->x, 3);
+// the standard parallel algorithms should accept BucketStorage iterators
+TEST(parallel, execution_policy)
+{
+	auto [bs, v] = random_int_bs_v(64, 20000);
+	long long expected = std::accumulate(v.begin(), v.end(), 0LL);
+	EXPECT_EQ(std::reduce(std::execution::par, bs.cbegin(), bs.cend(), 0LL), expected);
+	std::for_each(std::execution::par, bs.begin(), bs.end(), [](int &x) { ++x; });
+	EXPECT_EQ(std::transform_reduce(std::execution::par, bs.begin(), bs.end(), 0LL, std::plus<>(), [](int x) { return (long long)x; }),
+			  expected + (long long)v.size());
+	EXPECT_EQ(std::count_if(std::execution::par_unseq, bs.begin(), bs.end(), [](int x) { return x % 2 == 0; }),
+			  std::count_if(v.begin(), v.end(), [](int x) { return x % 2 == 1; }));
 }
+#endif
 
-// assumes insertion order
-TEST(assuming_order, block_capacity_extremes1)
+#if SEGMENTS_TEST
+// segments() yields { values, mask } per block: values is a std::span over the block's slots
+// and mask[i] tells whether values[i] holds a live element
+TEST(segments, view)
 {
-	BucketStorage< S > ss1(1);
-	EXPECT_EQ(ss1.insert(S(1))->x, 1);
-	EXPECT_EQ(ss1.insert(S(2))->x, 2);
-	EXPECT_EQ(ss1.insert(S(3))->x, 3);
+	for (size_t capacity : { 1, 5, 64, 100 })
+	{
+		auto [bs, v] = random_bs_v();
+		BucketStorage< S > sparse(capacity);
+		for (auto &s : bs)
+		{
+			sparse.insert(s);
+		}
+		for (int i = 0; i < 50; ++i)
+		{
+			sparse.erase(random_position(sparse));
+		}
 
-	auto it = ss1.begin();
-	EXPECT_EQ((it++)->x, 1);
-	EXPECT_EQ((it++)->x, 2);
-	EXPECT_EQ((it++)->x, 3);
-	EXPECT_EQ(it, ss1.end());
+		std::vector< int > iterated, segmented;
+		for (auto &s : sparse)
+		{
+			iterated.push_back(s.x);
+		}
+		size_t segment_count = 0;
+		for (auto &&[values, mask] : sparse.segments())
+		{
+			EXPECT_TRUE((std::same_as< std::remove_cvref_t< decltype(values) >, std::span< S > >));
+			EXPECT_LE(values.size(), capacity);
+			EXPECT_FALSE(values.empty()) << "empty blocks should be skipped";
+			for (size_t i = 0; i < values.size(); ++i)
+			{
+				if (mask[i])
+				{
+					segmented.push_back(values[i].x);
+				}
+			}
+			++segment_count;
+		}
+		EXPECT_EQ(segmented, iterated) << "block capacity " << capacity << ": segments should follow iteration order";
+		EXPECT_LE(segment_count * capacity, sparse.capacity());
+
+		const BucketStorage< S > &const_bs = sparse;
+		for (auto &&[values, mask] : const_bs.segments())
+		{
+			EXPECT_TRUE((std::same_as< std::remove_cvref_t< decltype(values) >, std::span< const S > >));
+			(void)mask;
+		}
+	}
+
+	BucketStorage< S > empty;
+	EXPECT_TRUE(std::ranges::empty(empty.segments()));
 }
 
-TEST(typing, cbegin)
+TEST(segments, write_through)
 {
-	const BucketStorage< S > const_bs;
-	EXPECT_TRUE((std::same_as< decltype(const_bs.begin()), BucketStorage< S >::const_iterator >))
-		<< "begin() should have a "
-		   "const overload that "
-		   "returns const_iterator";
-	EXPECT_TRUE((std::same_as< decltype(const_bs.end()), BucketStorage< S >::const_iterator >))
-		<< "end() should have a "
-		   "const overload that "
-		   "returns const_iterator";
-	BucketStorage< S > bs;
-	EXPECT_TRUE((std::same_as< decltype(bs.begin()), BucketStorage< S >::iterator >));
-	EXPECT_TRUE((std::same_as< decltype(bs.end()), BucketStorage< S >::iterator >));
+	auto [bs, v] = random_bs_v();
+	for (auto &&[values, mask] : bs.segments())
+	{
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			if (mask[i])
+			{
+				values[i].x = -values[i].x;
+			}
+		}
+	}
+	for (auto &s : v)
+	{
+		s.x = -s.x;
+	}
+	expect_same_elements(bs, v);
+}
 
-	EXPECT_TRUE((std::same_as< decltype(bs.cbegin()), BucketStorage< S >::const_iterator >));
-	EXPECT_TRUE((std::same_as< decltype(bs.cend()), BucketStorage< S >::const_iterator >));
+// segment-aware overloads of find, count, copy, for_each and any_of
+TEST(segments, algorithms)
+{
+	auto [bs, v] = random_bs_v();
+	const BucketStorage< S > &const_bs = bs;
+	for (int i = 0; i < 50; ++i)
+	{
+		S value(randint(-10, Id::get_id() + 10));
+		EXPECT_EQ(find(bs, value), std::find(bs.begin(), bs.end(), value));
+		EXPECT_EQ(find(const_bs, value), std::find(const_bs.begin(), const_bs.end(), value));
+		EXPECT_EQ(count(bs, value), std::count(bs.begin(), bs.end(), value));
+	}
+	bs.insert(S(0));
+	bs.insert(S(0));
+	EXPECT_EQ(count(bs, S(0)), 2);
+
+	std::vector< S > copied;
+	copy(const_bs, std::back_inserter(copied));
+	EXPECT_TRUE(std::equal(copied.begin(), copied.end(), bs.begin(), bs.end())) << "copy should keep iteration order";
 
+	long long sum = 0;
+	for_each(bs, [&](S &s) { sum += s.x; });
+	long long expected = 0;
+	for (auto &s : bs)
 	{
-		BucketStorage< S >::const_iterator const_it = bs.begin();	 // implicit conversion
-		(void)const_it;
+		expected += s.x;
 	}
+	EXPECT_EQ(sum, expected);
 
-	// BucketStorage< S >::iterator it(const_it);	   // should not compile
-	bs.insert(S(78));
-	BucketStorage< S >::iterator b = bs.begin();
-	BucketStorage< S >::iterator it = b;
-	EXPECT_EQ(*b, *it);
+	EXPECT_TRUE(any_of(bs, [](const S &s) { return s.x == 0; }));
+	EXPECT_FALSE(any_of(bs, [](const S &s) { return s.x < 0; }));
+	BucketStorage< S > empty;
+	EXPECT_FALSE(any_of(empty, [](const S &) { return true; }));
+	EXPECT_EQ(find(empty, S(0)), empty.end());
+}
+#endif
 
-	BucketStorage< S >::const_iterator cb = bs.cbegin();
-	BucketStorage< S >::const_iterator const_it = cb;
-	EXPECT_EQ(*cb, *const_it);
+#if INLINE_TEST
+// SmallBucketStorage< T, InlineN > keeps its first InlineN elements inside the object
 
-	// it = cb; // should not compile
-	cb = it;
-	EXPECT_EQ(*cb, *it);
+template< typename T, size_t InlineN >
+bool is_inline(const SmallBucketStorage< T, InlineN > &ss, const T &element)
+{
+	auto object = reinterpret_cast< const std::byte * >(&ss);
+	auto address = reinterpret_cast< const std::byte * >(&element);
+	return std::less_equal<>()(object, address) && std::less<>()(address, object + sizeof ss);
+}
 
-	std::cout << *it << '\n';
-	std::cout << *const_it << '\n';
+TEST(inline_block, no_heap)
+{
+	S::actions.reserve(1000);	 // logging should not allocate either
+	NewCounter::start();
+	{
+		SmallBucketStorage< S, 4 > ss;
+		EXPECT_EQ(ss.capacity(), 4);
+		for (int i = 1; i <= 4; ++i)
+		{
+			EXPECT_TRUE(is_inline(ss, *ss.insert(S(i))));
+		}
+		ss.erase(ss.begin());
+		ss.insert(S(5));
+		EXPECT_EQ(ss.size(), 4);
+	}
+	EXPECT_EQ(NewCounter::stop(), 0) << "tiny storages should not touch the heap";
+
+	SmallBucketStorage< S, 4 > ss(8);
+	for (int i = 1; i <= 5; ++i)
+	{
+		ss.insert(S(i));
+	}
+	EXPECT_EQ(ss.capacity(), 12) << "the inline block and one heap block";
+	EXPECT_FALSE(is_inline(ss, *ss.insert(S(6))));
 }
 
-TEST(typing, const_bs)
+// assumes insertion order
+TEST(inline_block, insertion_order)
 {
-	const BucketStorage< S > const_bs;
-	for (auto &s : const_bs)
+	SmallBucketStorage< S, 3 > ss(2);
+	for (int i = 1; i <= 10; ++i)
 	{
-		(void)s;
+		EXPECT_EQ(ss.insert(S(i))->x, i);
+	}
+	int i = 0;
+	for (auto &s : ss)
+	{
+		EXPECT_EQ(s.x, ++i) << "incorrect value\n";
+	}
+	auto it = ss.end();
+	while (!ss.empty())
+	{
+		--it;
+		EXPECT_EQ(it->x, i--) << "incorrect value\n";
+		it = ss.erase(it);
 	}
-	BucketStorage< S > bs = const_bs;
-	bs.insert(S(1));
-	const auto it = bs.begin();
-	EXPECT_EQ(it->x, 1);
 }
 
-template< class ContainerType >
-concept Container = requires(ContainerType a, const ContainerType b) {
-	requires std::semiregular< ContainerType >;
-	requires std::swappable< ContainerType >;
-	requires std::destructible< typename ContainerType::value_type >;
-	requires std::same_as< typename ContainerType::reference, typename ContainerType::value_type & >;
-	requires std::same_as< typename ContainerType::const_reference, const typename ContainerType::value_type & >;
-	requires std::forward_iterator< typename ContainerType::iterator >;
-	requires std::forward_iterator< typename ContainerType::const_iterator >;
-	requires std::signed_integral< typename ContainerType::difference_type >;
-	requires std::same_as< typename ContainerType::difference_type, typename std::iterator_traits< typename ContainerType::iterator >::difference_type >;
-	requires std::same_as< typename ContainerType::difference_type, typename std::iterator_traits< typename ContainerType::const_iterator >::difference_type >;
-	{ a.begin() } -> std::same_as< typename ContainerType::iterator >;
-	{ a.end() } -> std::same_as< typename ContainerType::iterator >;
-	{ b.begin() } -> std::same_as< typename ContainerType::const_iterator >;
-	{ b.end() } -> std::same_as< typename ContainerType::const_iterator >;
-	{ a.cbegin() } -> std::same_as< typename ContainerType::const_iterator >;
-	{ a.cend() } -> std::same_as< typename ContainerType::const_iterator >;
-	{ a.size() } -> std::same_as< typename ContainerType::size_type >;
-	/*
+// elements in the inline block cannot be stolen, they have to be moved into the new object
+TEST(inline_block, move_and_swap)
+{
+	auto values = [](const SmallBucketStorage< S, 4 > &ss)
 	{
-		// maybe we don't really need this
-		// unless you find a sensible way to calculate this
-		a.max_size()
-	} -> std::same_as< typename ContainerType::size_type >;
-	*/
-	{ a.empty() } -> std::same_as< bool >;
-};
-template< Container C >
-void container_f(C c)
+		std::vector< int > data;
+		for (auto &s : ss)
+		{
+			data.push_back(s.x);
+		}
+		std::sort(data.begin(), data.end());
+		return data;
+	};
+	auto all_inline = [](const SmallBucketStorage< S, 4 > &ss)
+	{
+		return std::all_of(ss.begin(), ss.end(), [&](const S &s) { return is_inline(ss, s); });
+	};
+
+	SmallBucketStorage< S, 4 > tiny;
+	tiny.insert(S(1));
+	tiny.insert(S(2));
+	SmallBucketStorage< S, 4 > moved(std::move(tiny));
+	EXPECT_EQ(values(moved), (std::vector< int >{ 1, 2 }));
+	EXPECT_TRUE(all_inline(moved));
+
+	SmallBucketStorage< S, 4 > big(3);
+	for (int i = 10; i < 20; ++i)
+	{
+		big.insert(S(i));
+	}
+	auto big_values = values(big);
+	moved.swap(big);
+	EXPECT_EQ(values(moved), big_values);
+	EXPECT_EQ(values(big), (std::vector< int >{ 1, 2 }));
+	EXPECT_TRUE(all_inline(big));
+
+	SmallBucketStorage< S, 4 > assigned;
+	assigned.insert(S(-1));
+	assigned = std::move(big);
+	EXPECT_EQ(values(assigned), (std::vector< int >{ 1, 2 }));
+	EXPECT_TRUE(all_inline(assigned));
+	assigned = moved;
+	EXPECT_EQ(values(assigned), big_values);
+}
+
+TEST(inline_block, shrink_to_fit)
 {
-	(void)c;
+	SmallBucketStorage< S, 4 > ss(4);
+	for (int i = 0; i < 20; ++i)
+	{
+		ss.insert(S(i));
+	}
+	for (auto it = ss.begin(); it != ss.end();)
+	{
+		it = it->x % 7 == 0 ? ++it : ss.erase(it);
+	}
+	ss.shrink_to_fit();
+	EXPECT_EQ(ss.capacity(), 4) << "3 elements fit in the inline block";
+	std::vector< int > data;
+	for (auto &s : ss)
+	{
+		EXPECT_TRUE(is_inline(ss, s));
+		data.push_back(s.x);
+	}
+	std::sort(data.begin(), data.end());
+	EXPECT_EQ(data, (std::vector< int >{ 0, 7, 14 }));
 }
 
-TEST(typing, concepts)
+// compile with -fsanitize=address
+TEST(inline_block, memory_leaks)
 {
-	EXPECT_TRUE(std::is_default_constructible< BucketStorage< S > >());
-	EXPECT_TRUE(std::is_copy_assignable< BucketStorage< S > >());
-	EXPECT_TRUE(std::is_move_assignable< BucketStorage< S > >());
-	EXPECT_TRUE(std::copy_constructible< BucketStorage< S > >);
-	EXPECT_TRUE(std::move_constructible< BucketStorage< S > >);
-	EXPECT_TRUE(std::destructible< BucketStorage< S > >);
+	SmallBucketStorage< M, 2 > ss(3);
+	for (int i = 0; i < 200; ++i)
+	{
+		if (randdouble() < 0.3 && !ss.empty())
+		{
+			ss.erase(ss.begin());
+		}
+		else
+		{
+			ss.insert(M(i));
+		}
+		if (i % 50 == 0)
+		{
+			SmallBucketStorage< M, 2 > copy = ss;
+			SmallBucketStorage< M, 2 > other(std::move(copy));
+			other.swap(ss);
+			ss.shrink_to_fit();
+		}
+	}
+}
 
-	EXPECT_TRUE(Container< BucketStorage< S > >);
-	// container_f(BucketStorage< S >());	  // uncomment to see why it's failing
+TEST(inline_block, concepts)
+{
+	EXPECT_TRUE((Container< SmallBucketStorage< S, 4 > >));
 }
+#endif
 
 int iterations = 10000;
 const double delete_prob = 0.2;
@@ -677,13 +3080,23 @@ TEST(methods, memory_leaks)
 	}
 }
 
+// Benchmark payloads besides int, Pod and M: unlike S they do no bookkeeping of their own,
+// so the benchmarks below time the container and not S::actions
+struct Wide256
+{
+	explicit Wide256(int i) : x{ i } {}
+	int x[64];
+};
+static_assert(sizeof(Wide256) == 256);
+
 // A relative benchmark that can be used to optimize the data structure.
 // Includes inserting, erasing and iterating (before every erase).
 // NOTE: pass in any integer as commandline arguments to change the iterations value
-TEST(benchmark, insert_erase_iter)
+template< typename T >
+void insert_erase_iter()
 {
 	std::cout << "Benchmark: " << iterations << " iterations\n";
-	BucketStorage< S > bs;
+	BucketStorage< T > bs;
 
 	for (int i = 0; i < iterations; i++)
 	{
@@ -700,16 +3113,81 @@ TEST(benchmark, insert_erase_iter)
 		}
 		else
 		{
-			bs.insert(S(Id::get_id()));	   // insert
+			bs.insert(T{ Id::get_id() });	   // insert
+		}
+	}
+}
+
+TEST(benchmark, insert_erase_iter)
+{
+	insert_erase_iter< int >();
+}
+
+TEST(benchmark, insert_erase_iter_pod64)
+{
+	insert_erase_iter< Pod >();
+}
+
+TEST(benchmark, insert_erase_iter_wide256)
+{
+	insert_erase_iter< Wide256 >();
+}
+
+TEST(benchmark, insert_erase_iter_heap)
+{
+	insert_erase_iter< M >();
+}
+
+// The same operations as insert_erase_iter
+// with the erase position found by get_to_distance instead of a walk
+TEST(benchmark, insert_erase_get_to_distance)
+{
+	std::cout << "Benchmark: " << iterations << " iterations\n";
+	BucketStorage< int > bs;
+
+	for (int i = 0; i < iterations; i++)
+	{
+		random_churn_step(bs, delete_prob, [] { return Id::get_id(); });
+	}
+}
+
+// Iteration only, over a storage where 90% of the elements were erased
+TEST(benchmark, sparse_iteration)
+{
+	BucketStorage< int > bs;
+	for (int i = 0; i < iterations * 10; ++i)
+	{
+		bs.insert(i);
+	}
+	for (auto it = bs.begin(); it != bs.end();)
+	{
+		if (randdouble() < 0.9)
+		{
+			it = bs.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	std::cout << "Benchmark: " << bs.size() << " of " << bs.capacity() << " slots live\n";
+	long long sum = 0;
+	for (int i = 0; i < 100; ++i)
+	{
+		for (int x : bs)
+		{
+			sum += x;
 		}
 	}
+	EXPECT_GE(sum, 0);
 }
 
 // This is the control benchmark of the same operations as the above test
 // performed with a vector to compare gains in speed.
-TEST(benchmark, insert_erase_iter_vector)
+template< typename T >
+void insert_erase_iter_vector()
 {
-	std::vector< S > v;
+	std::vector< T > v;
 
 	for (int i = 0; i < iterations; i++)
 	{
@@ -726,10 +3204,421 @@ TEST(benchmark, insert_erase_iter_vector)
 		}
 		else
 		{
-			v.push_back(S(Id::get_id()));	 // insert
+			v.push_back(T{ Id::get_id() });	 // insert
+		}
+	}
+}
+
+TEST(benchmark, insert_erase_iter_vector)
+{
+	insert_erase_iter_vector< int >();
+}
+
+TEST(benchmark, insert_erase_iter_vector_pod64)
+{
+	insert_erase_iter_vector< Pod >();
+}
+
+TEST(benchmark, insert_erase_iter_vector_wide256)
+{
+	insert_erase_iter_vector< Wide256 >();
+}
+
+TEST(benchmark, insert_erase_iter_vector_heap)
+{
+	insert_erase_iter_vector< M >();
+}
+
+#if RANGE_INSERT_TEST
+// Bulk loading: range insert of a trivially copyable type
+// (see range_insert_loop below for the per-element control)
+TEST(benchmark, range_insert)
+{
+	std::vector< int > data(size_t(iterations) * 100);
+	std::iota(data.begin(), data.end(), 0);
+	std::cout << "Benchmark: " << data.size() << " elements\n";
+	BucketStorage< int > bs;
+	bs.insert(data.begin(), data.end());
+	EXPECT_EQ(bs.size(), data.size());
+}
+
+// The same load performed with a loop of insert()
+TEST(benchmark, range_insert_loop)
+{
+	std::vector< int > data(size_t(iterations) * 100);
+	std::iota(data.begin(), data.end(), 0);
+	BucketStorage< int > bs;
+	for (int x : data)
+	{
+		bs.insert(x);
+	}
+	EXPECT_EQ(bs.size(), data.size());
+}
+#endif
+
+#if CONCURRENT_TEST
+// insert_erase_iter for 1 to N threads sharing one ConcurrentBucketStorage,
+// reports throughput in operations per second
+TEST(benchmark, concurrent_insert_erase)
+{
+	const int max_threads = int(std::max(1u, std::thread::hardware_concurrency()));
+	std::cout << "Benchmark: " << iterations * 10 << " operations per thread\n";
+	// powers of two, always ending with max_threads
+	for (int threads = 1; threads <= max_threads; threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2)
+	{
+		ConcurrentBucketStorage< int > cbs;
+		auto start = std::chrono::steady_clock::now();
+		std::vector< std::thread > pool;
+		for (int t = 0; t < threads; ++t)
+		{
+			pool.emplace_back(
+				[&, t]()
+				{
+					std::mt19937 local_rng(seed + t);
+					std::uniform_real_distribution<> prob(0.0, 1.0);
+					std::vector< ConcurrentBucketStorage< int >::iterator > mine;
+					for (int i = 0; i < iterations * 10; i++)
+					{
+						if (prob(local_rng) <= delete_prob && !mine.empty())
+						{
+							size_t pos = local_rng() % mine.size();
+							cbs.erase(mine[pos]);	 // erase
+							mine[pos] = mine.back();
+							mine.pop_back();
+						}
+						else
+						{
+							mine.push_back(cbs.insert(i));	  // insert
+						}
+					}
+				});
+		}
+		for (auto &thread : pool)
+		{
+			thread.join();
+		}
+		std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << threads << " threads: " << size_t(threads * iterations * 10 / elapsed.count()) << " ops/s\n";
+	}
+}
+#endif
+
+#if PARALLEL_TEST
+// parallel_transform_reduce over a large storage with 1 to N pool threads
+TEST(benchmark, parallel_transform_reduce)
+{
+	BucketStorage< int > bs;
+	for (int i = 0; i < iterations * 1000; ++i)
+	{
+		bs.insert(i);
+	}
+	std::cout << "Benchmark: " << bs.size() << " elements\n";
+	auto transform = [](int x) { return std::sqrt(double(x)); };
+	const size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+	// powers of two, always ending with max_threads
+	for (size_t threads = 1; threads <= max_threads; threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2)
+	{
+		ThreadPool pool(threads);
+		auto start = std::chrono::steady_clock::now();
+		double sum = parallel_transform_reduce(pool, bs, 0.0, std::plus<>(), transform);
+		std::chrono::duration< double, std::milli > elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << threads << " threads: " << elapsed.count() << " ms (" << sum << ")\n";
+	}
+}
+#endif
+
+#if SEGMENTS_TEST
+// segmented find() vs std::find() over a large storage with holes
+TEST(benchmark, segmented_find)
+{
+	BucketStorage< int > bs;
+	for (int i = 0; i < iterations * 100; ++i)
+	{
+		bs.insert(i);
+	}
+	for (auto it = bs.begin(); it != bs.end();)
+	{
+		it = randdouble() < 0.3 ? bs.erase(it) : ++it;
+	}
+	std::cout << "Benchmark: " << bs.size() << " elements\n";
+	for (int i = 0; i < 20; ++i)
+	{
+		EXPECT_EQ(find(bs, -1), bs.end());
+	}
+}
+
+// The control benchmark performing the same searches with std::find
+TEST(benchmark, segmented_find_std)
+{
+	BucketStorage< int > bs;
+	for (int i = 0; i < iterations * 100; ++i)
+	{
+		bs.insert(i);
+	}
+	for (auto it = bs.begin(); it != bs.end();)
+	{
+		it = randdouble() < 0.3 ? bs.erase(it) : ++it;
+	}
+	for (int i = 0; i < 20; ++i)
+	{
+		EXPECT_EQ(std::find(bs.begin(), bs.end(), -1), bs.end());
+	}
+}
+#endif
+
+#if RELOCATE_TEST
+// Copying a storage of 64 byte PODs (see copy_pod_vector below for the memcpy baseline)
+TEST(benchmark, copy_pod)
+{
+	BucketStorage< Pod > bs;
+	for (int i = 0; i < iterations * 100; ++i)
+	{
+		bs.insert(Pod{ i, {} });
+	}
+	std::cout << "Benchmark: " << bs.size() << " elements\n";
+	for (int i = 0; i < 10; ++i)
+	{
+		BucketStorage< Pod > copy(bs);
+		EXPECT_EQ(copy.size(), bs.size());
+	}
+}
+
+// The same copies performed with a vector
+TEST(benchmark, copy_pod_vector)
+{
+	std::vector< Pod > v;
+	for (int i = 0; i < iterations * 100; ++i)
+	{
+		v.push_back(Pod{ i, {} });
+	}
+	for (int i = 0; i < 10; ++i)
+	{
+		std::vector< Pod > copy(v);
+		EXPECT_EQ(copy.size(), v.size());
+	}
+}
+#endif
+
+#if RETENTION_TEST
+// Oscillating around a block boundary: every crossing empties or refills a block
+// (compare with boundary_churn_retained below)
+TEST(benchmark, boundary_churn)
+{
+	BucketStorage< int > bs(64);
+	for (int i = 0; i < 64; ++i)
+	{
+		bs.insert(i);
+	}
+	for (int i = 0; i < iterations * 100; ++i)
+	{
+		bs.erase(bs.insert(i));
+	}
+	EXPECT_EQ(bs.size(), 64);
+}
+
+// The same churn with one block retained
+TEST(benchmark, boundary_churn_retained)
+{
+	BucketStorage< int > bs(64);
+	bs.set_block_retention(1);
+	for (int i = 0; i < 64; ++i)
+	{
+		bs.insert(i);
+	}
+	for (int i = 0; i < iterations * 100; ++i)
+	{
+		bs.erase(bs.insert(i));
+	}
+	EXPECT_EQ(bs.size(), 64);
+}
+#endif
+
+#if PREFETCH_TEST
+// Iteration only, over a storage much larger than the last level cache,
+// for several prefetch distances (0 disables prefetching)
+TEST(benchmark, prefetch_iteration)
+{
+	const size_t capacity = 256;
+	const size_t bytes = size_t(256) << 20;	   // independent of iterations
+	BucketStorage< int > bs(capacity);
+	// random sized allocations between the blocks scatter them over the heap,
+	// so the hardware prefetcher can not stream across block boundaries
+	std::vector< std::unique_ptr< char[] > > filler;
+	for (size_t i = 0; i < bytes / sizeof(int); ++i)
+	{
+		if (i % capacity == 0)
+		{
+			filler.emplace_back(new char[randint(64, 1024)]);
+		}
+		bs.insert(int(i));
+	}
+	std::cout << "Benchmark: " << bs.size() * sizeof(int) / (1 << 20) << " MiB of elements\n";
+	const int passes = 3;
+	for (size_t distance : { 0, 1, 4, 16, 64 })
+	{
+		bs.set_prefetch_distance(distance);
+		long long sum = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int pass = 0; pass < passes; ++pass)
+		{
+			for (int x : bs)
+			{
+				sum += x;
+			}
+		}
+		std::chrono::duration< double, std::nano > elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "distance " << distance << ": " << elapsed.count() / (passes * bs.size()) << " ns/element (" << sum << ")\n";
+	}
+}
+#endif
+
+#if MERGE_TEST
+// Merging per-thread staging storages into a global one
+// (see merge_insert_loop below for the element-wise control)
+TEST(benchmark, merge)
+{
+	BucketStorage< int > global;
+	for (int batch = 0; batch < 100; ++batch)
+	{
+		BucketStorage< int > staging;
+		for (int i = 0; i < iterations; ++i)
+		{
+			staging.insert(i);
+		}
+		global.merge(std::move(staging));
+	}
+	EXPECT_EQ(global.size(), size_t(iterations) * 100);
+}
+
+TEST(benchmark, merge_insert_loop)
+{
+	BucketStorage< int > global;
+	for (int batch = 0; batch < 100; ++batch)
+	{
+		BucketStorage< int > staging;
+		for (int i = 0; i < iterations; ++i)
+		{
+			staging.insert(i);
+		}
+		for (int x : staging)
+		{
+			global.insert(x);
+		}
+	}
+	EXPECT_EQ(global.size(), size_t(iterations) * 100);
+}
+#endif
+
+// Finding a free slot: a large full storage where every insert has to find
+// the single hole left by the previous erase
+TEST(benchmark, free_slot_lookup)
+{
+	BucketStorage< int > bs(64);
+	std::vector< BucketStorage< int >::iterator > elements;	  // iterators stay valid across insert/erase
+	for (int i = 0; i < iterations * 10; ++i)
+	{
+		elements.push_back(bs.insert(i));
+	}
+	for (int i = 0; i < iterations * 10; ++i)
+	{
+		auto &element = elements[randint(0, int(elements.size() - 1))];
+		bs.erase(element);
+		element = bs.insert(i);
+	}
+	EXPECT_EQ(bs.size(), size_t(iterations) * 10);
+}
+
+#if CONCURRENT_STACK_TEST
+// push/pop pairs from 1 to N threads: ConcurrentStack< int > vs a mutex guarded Stack< int >
+TEST(benchmark, concurrent_stack)
+{
+	const int operations = iterations * 100;
+	const int max_threads = int(std::max(1u, std::thread::hardware_concurrency()));
+	auto run = [&](int threads, auto &&push_pop)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::vector< std::thread > pool;
+		for (int t = 0; t < threads; ++t)
+		{
+			pool.emplace_back(
+				[&]()
+				{
+					for (int i = 0; i < operations; ++i)
+					{
+						push_pop(i);
+					}
+				});
+		}
+		for (auto &thread : pool)
+		{
+			thread.join();
+		}
+		std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - start;
+		return size_t(threads * operations / elapsed.count());
+	};
+	std::cout << "Benchmark: " << operations << " push/pop pairs per thread\n";
+	// powers of two, always ending with max_threads
+	for (int threads = 1; threads <= max_threads; threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2)
+	{
+		ConcurrentStack< int > lock_free;
+		size_t lock_free_ops = run(threads,
+								   [&](int i)
+								   {
+									   lock_free.push(i);
+									   lock_free.pop();
+								   });
+		Stack< int > stack;
+		std::mutex mutex;
+		size_t mutex_ops = run(threads,
+							   [&](int i)
+							   {
+								   std::lock_guard< std::mutex > lock(mutex);
+								   stack.push(i);
+								   stack.pop();
+							   });
+		std::cout << threads << " threads: " << lock_free_ops << " ops/s lock-free, " << mutex_ops << " ops/s mutex\n";
+	}
+}
+#endif
+
+#if STACK_BULK_TEST
+// Rebuilding a free list of millions of slot indices with push_bulk()
+// (see stack_push_loop below for the one-by-one control)
+TEST(benchmark, stack_push_bulk)
+{
+	std::vector< size_t > slots(size_t(iterations) * 500);
+	std::iota(slots.begin(), slots.end(), size_t(0));
+	std::cout << "Benchmark: " << slots.size() << " slots\n";
+	Stack< size_t > stack;
+	for (int i = 0; i < 10; ++i)
+	{
+		stack.push_bulk(std::span< const size_t >(slots));
+		std::vector< size_t > out;
+		out.reserve(slots.size());
+		EXPECT_EQ(stack.pop_bulk(slots.size(), std::back_inserter(out)), slots.size());
+	}
+}
+
+TEST(benchmark, stack_push_loop)
+{
+	std::vector< size_t > slots(size_t(iterations) * 500);
+	std::iota(slots.begin(), slots.end(), size_t(0));
+	Stack< size_t > stack;
+	for (int i = 0; i < 10; ++i)
+	{
+		for (size_t slot : slots)
+		{
+			stack.push(slot);
+		}
+		std::vector< size_t > out;
+		out.reserve(slots.size());
+		for (size_t j = 0; j < slots.size(); ++j)
+		{
+			out.push_back(stack.pop());
 		}
 	}
 }
+#endif
 
 class TraceHandler : public testing::EmptyTestEventListener
 {